@@ -13,108 +13,200 @@
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <map>
+#include <algorithm>
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "rapidxml.hpp"
 #include "rapidxml_print.hpp"
 #include "rapidxml_utils.hpp"
 
 
-// We extend rapidxml with some high-level functions
-namespace rapidxml
-{
-  // Given an XML node, recursively find the first child node (e.g. not including the 
-  // passed node) that has an attribute with the passed name and value. 
-  // Uses string matching on the attribute value. If no value is found 
-  // 0 is returned
-  //
-  // http://stackoverflow.com/questions/5465227
-  template<class Ch>
-  inline xml_node<Ch>* get_child_with_attribute(xml_node<Ch> *node, 
-    std::string attribute_name, std::string attribute_value)
-  {
-    // Cycles every child
-    for (xml_node<> *nodeChild = 
-        node->first_node(); 
-        nodeChild; 
-        nodeChild = nodeChild->next_sibling())
-    {
-      xml_attribute<Ch>* attribute = nodeChild->first_attribute(attribute_name.c_str());
-      if (attribute != 0 && strcmp(attribute->value(), attribute_value.c_str()) == 0)
-        return nodeChild;
-
-      xml_node<Ch>* x = get_child_with_attribute(nodeChild, 
-          attribute_name, attribute_value);
-      if (x != 0) 
-        return x;
-    }
-    return 0;
-  }
-}
-
-// Set log_level as high as you want to enable that logging level
-// and all below it. 999 will be very verbose
-#define LOG_LEVEL 999
-#define LOG_ERROR  10
-#define LOG_DEBUG  30
-#define LOG_INFO  100
-
-void dove::xlog(const char* msg, int level) {
-  if (level <= LOG_LEVEL)
-    std::cout << "dove: " << msg << std::endl;
-}
-
-void dove::info(const char* msg) { xlog(msg, LOG_INFO); }
-void dove::error(const char* msg) { xlog(msg, LOG_ERROR); }
-void dove::xdebug(const char* msg) { xlog(msg, LOG_DEBUG); }
-
-// TODO make this set type on hardware component
-void dove::parse_pids(rapidxml::xml_document<char> &system, 
-  std::string logical_id,
-  int &node_pid, 
-  int &proc_pid, 
-  int &core_pid, 
-  int &hwth_pid, 
-  std::string &hostname, 
-  std::string &ip) {
-
-rapidxml::xml_node<>* nodes = system.first_node("system")->
-  first_node("nodes");
-rapidxml::xml_node<>* node = get_child_with_attribute(nodes, "id", 
-    logical_id);
-
-// While we have not returned to the root
-while (strcmp(node->name(), "nodes") != 0) {
-  std::string name = node->name();
-  int pindex = atoi( node->first_attribute("pindex")->value() );
-  if (name.compare("pu") == 0) {
-    hwth_pid = pindex;
-  }
-  else if (name.compare("core") == 0)
-    core_pid = pindex;
-  else if (name.compare("socket") == 0) 
-    proc_pid = pindex;
-  else if (name.compare("node") == 0) {
-    node_pid = pindex;
-      ip = node->first_attribute("ip")->value();
-      hostname = node->first_attribute("hostname")->value();
-    }
-    else
+int dove::parse_log_level(const char* level) {
+  if (strcasecmp(level, "error") == 0)
+    return LOG_ERROR;
+  if (strcasecmp(level, "debug") == 0)
+    return LOG_DEBUG;
+  if (strcasecmp(level, "info") == 0)
+    return LOG_INFO;
+  if (strcasecmp(level, "all") == 0)
+    return LOG_ALL;
+  char* end;
+  long value = strtol(level, &end, 10);
+  if (end == level || *end != '\0')
+    throw "Unknown log level. Use error, debug, info, all or a number";
+  return (int) value;
+}
+
+static int initial_log_level() {
+  const char* env = getenv("DOVE_LOG_LEVEL");
+  if (env == 0 || *env == '\0')
+    return dove::LOG_ALL;
+  try {
+    return dove::parse_log_level(env);
+  } catch (const char* e) {
+    std::cerr << "dove: Ignoring DOVE_LOG_LEVEL. " << e << std::endl;
+    return dove::LOG_ALL;
+  }
+}
+
+int dove::log_level = initial_log_level();
+static std::string log_name = "dove";
+
+void dove::set_log_level(int level) { log_level = level; }
+void dove::set_log_name(const char* name) { log_name = name; }
+
+void dove::write_log(const char* msg, int level) {
+  std::cout << log_name << ": " << msg << '\n';
+  // Errors are often followed by a throw that ends the program
+  // without flushing, so do not let them sit in the buffer
+  if (level <= LOG_ERROR)
+    std::cout.flush();
+}
+
+// Converts a speed attribute such as "2.4GHz", "800MHz" or "2400" 
+// (assumed MHz) into MHz. Returns 0 if the speed cannot be read
+static double parse_speed_mhz(const char* speed) {
+  char* unit;
+  double value = strtod(speed, &unit);
+  while (*unit == ' ')
+    unit++;
+  if (strncasecmp(unit, "ghz", 3) == 0)
+    return value * 1000;
+  if (strncasecmp(unit, "khz", 3) == 0)
+    return value / 1000;
+  return value;
+}
+
+dove::system_index::system_index(rapidxml::xml_document<char> &system) {
+  xdebug("Indexing system.xml");
+  rapidxml::xml_node<>* nodes = system.first_node("system")->
+    first_node("nodes");
+
+  // The tree under <nodes> is always node/socket/core/pu, so one walk
+  // fills in every component with the pids of all of its parents
+  for (rapidxml::xml_node<char>* node = nodes->first_node();
+      node;
+      node = node->next_sibling()) {
+    if (strcmp(node->name(), "node") != 0)
       throw "Unknown tag in XML. Valid values underneath 'nodes' are node,socket,core,pu";
-    
-    node = node->parent();
-  }   
+    // OpenMPI slot list of every core on this host, one socket per entry
+    std::ostringstream host_slot;
+    host_slot << "p";
+    hwcom host;
+    host.type = HOST;
+    host.node_pid = atoi(node->first_attribute("pindex")->value());
+    host.ip = node->first_attribute("ip")->value();
+    host.hostname = node->first_attribute("hostname")->value();
+    int host_id = atoi(node->first_attribute("id")->value());
+    host.id = host.node_id = host_id;
+    coms_[host_id] = host;
+    hosts_.push_back(host_id);
+
+    for (rapidxml::xml_node<char>* socket = node->first_node();
+        socket;
+        socket = socket->next_sibling()) {
+      if (strcmp(socket->name(), "socket") != 0)
+        throw "Unknown tag in XML. Valid values underneath 'node' are socket";
+      hwcom proc = host;
+      proc.type = SOCKET;
+      proc.proc_pid = atoi(socket->first_attribute("pindex")->value());
+      int proc_id = atoi(socket->first_attribute("id")->value());
+      proc.id = proc.proc_id = proc_id;
+      rapidxml::xml_attribute<char>* speed = socket->first_attribute("speed");
+      if (speed != 0)
+        proc.speed = parse_speed_mhz(speed->value());
+      // Hosts run at the speed of their first socket
+      if (coms_[host_id].speed == 0)
+        coms_[host_id].speed = proc.speed;
+      coms_[proc_id] = proc;
+      sockets_.push_back(proc_id);
+      std::ostringstream proc_slot;
+      proc_slot << proc.proc_pid << ":";
+
+      for (rapidxml::xml_node<char>* core = socket->first_node();
+          core;
+          core = core->next_sibling()) {
+        if (strcmp(core->name(), "core") != 0)
+          throw "Unknown tag in XML. Valid values underneath 'socket' are core";
+        hwcom com = proc;
+        com.type = CORE;
+        com.core_pid = atoi(core->first_attribute("pindex")->value());
+        int core_id = atoi(core->first_attribute("id")->value());
+        com.id = com.core_id = core_id;
+        std::ostringstream core_slot;
+        core_slot << "p" << com.proc_pid << ":" << com.core_pid;
+        com.slot = core_slot.str();
+        coms_[core_id] = com;
+        cores_.push_back(core_id);
+        if (core != socket->first_node())
+          proc_slot << ",";
+        proc_slot << com.core_pid;
+
+        for (rapidxml::xml_node<char>* pu = core->first_node();
+            pu;
+            pu = pu->next_sibling()) {
+          if (strcmp(pu->name(), "pu") != 0)
+            throw "Unknown tag in XML. Valid values underneath 'core' are pu";
+          hwcom hwth = com;
+          hwth.type = HW_THREAD;
+          hwth.hwth_pid = atoi(pu->first_attribute("pindex")->value());
+          int hwth_id = atoi(pu->first_attribute("id")->value());
+          hwth.id = hwth_id;
+          std::ostringstream hwth_slot;
+          hwth_slot << "p" << hwth.hwth_pid;
+          hwth.slot = hwth_slot.str();
+          hwth.cpus = pu->first_attribute("pindex")->value();
+          coms_[hwth_id] = hwth;
+          threads_.push_back(hwth_id);
+
+          int holders[] = {core_id, proc_id, host_id};
+          for (int h = 0; h < 3; h++) {
+            std::string &cpus = coms_[holders[h]].cpus;
+            if (!cpus.empty())
+              cpus += ",";
+            cpus += hwth.cpus;
+          }
+        }
+      }
+
+      coms_[proc_id].slot = "p" + proc_slot.str();
+      if (socket != node->first_node())
+        host_slot << ";";
+      host_slot << proc_slot.str();
+    }
+
+    coms_[host_id].slot = host_slot.str();
+  }
 }
 
-// TODO make this set type on hardware component
-dove::hwcom dove::parse_pids(rapidxml::xml_document<char> &system, 
-    std::string logical_id) {
-  dove::hwcom com;
-  parse_pids(system, logical_id, 
-      com.node_pid, com.proc_pid, com.core_pid,
-      com.hwth_pid, com.hostname, com.ip);
-  return com;
+const dove::hwcom& dove::system_index::get(int logical_id) const {
+  std::unordered_map<int, hwcom>::const_iterator it = 
+    coms_.find(logical_id);
+  if (it == coms_.end())
+    throw "Logical ID was not found in system.xml";
+  return it->second;
+}
+
+const std::vector<int>& dove::system_index::get_ids(hwcom_type type) const {
+  switch (type) {
+    case HOST:
+      return hosts_;
+    case SOCKET:
+      return sockets_;
+    case CORE:
+      return cores_;
+    case HW_THREAD:
+      return threads_;
+    default:
+      throw "Hardware component type must be known to list components";
+  }
 }
 
 std::string dove::build_rankline_core(int task, 
@@ -135,34 +227,25 @@ std::string dove::build_rankline_core(int task, dove::hwcom com) {
   return build_rankline_core(task, com.hostname, com.proc_pid, com.core_pid);
 }
 
-std::string dove::build_rankline(rapidxml::xml_document<char> &system,
+std::string dove::build_rankline(const system_index &system,
     int taskid, 
-    std::string id) {
+    int id) {
   xdebug("Building rankline");
-  dove::hwcom com = parse_pids(system, id);
-
-  int type = com.type;
-  switch (type) {
-  case HW_THREAD:
-    // TODO support threads
-    throw "Only supports cores for now";
-    break;
-  case CORE:
-    return build_rankline_core(taskid, com);
-  case SOCKET:
-    // TODO support sockets
-    throw "Only supports cores for now";
-    break;
-  case HOST: 
-    throw "Only supports cores for now";
-    // TODO support hosts
-    break;
-  case UNKNOWN:
-  default: 
+  const dove::hwcom &com = system.get(id);
+  if (com.type == UNKNOWN)
     throw "Unknown hardware component type";
-    break;
-  }
-  throw "Unknown state";
+
+  // The slot was resolved when system.xml was indexed, e.g. 
+  // rank 1=10.0.2.4 slot=p12       (physical hardware thread 12)
+  // rank 1=10.0.2.4 slot=p1:8      (physical socket 1, core 8)
+  // rank 1=10.0.2.4 slot=p1:0,1,2  (any core of physical socket 1)
+  // rank 1=10.0.2.4 slot=p0:0,1;1:0,1 (any core of the host)
+  std::ostringstream out;
+  out << "rank " 
+    << taskid << "=" << com.hostname 
+    << " slot=" << com.slot << std::endl;
+
+  return out.str();
 }
 
 // TODO consider creating dove::xml and moving all of my 
@@ -248,145 +331,592 @@ std::vector<rapidxml::xml_node<char>*> dove::get_all_threads(
   return result;
 }
 
-// TODO add in a strategy for choosing specific hardware 
-// components e.g. ones on the same machine, etc
+std::vector<dove::edge_volume> dove::read_edge_volumes(const char* path,
+    const std::vector<std::vector<unsigned int> > &successors) {
+  std::vector<edge_volume> edges;
+  std::ifstream in(path);
+  if (!in)
+    return edges;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#')
+      continue;
+    edge_volume edge;
+    char extra;
+    if (sscanf(line.c_str(), "%d %d %llu %c", &edge.from, &edge.to, 
+          &edge.bytes, &extra) != 3 || edge.from < 0 || edge.to < 0) {
+      error(("Unable to parse edge volume: " + line).c_str());
+      throw "Edge volumes must be given as <from task> <to task> <bytes>";
+    }
+    if (edge.from >= successors.size() || 
+        std::find(successors[edge.from].begin(), successors[edge.from].end(),
+          (unsigned int) edge.to) == successors[edge.from].end()) {
+      error(("Edge volume is not an edge of the STG: " + line).c_str());
+      throw "Edge volumes must name an edge of the STG";
+    }
+    edges.push_back(edge);
+  }
+  return edges;
+}
+
+std::string dove::get_edges_path(const std::string &stg_path) {
+  size_t dot = stg_path.find_last_of('.');
+  size_t slash = stg_path.find_last_of('/');
+  if (dot == std::string::npos || 
+      (slash != std::string::npos && dot < slash))
+    return stg_path + ".edges";
+  return stg_path.substr(0, dot) + ".edges";
+}
+
+const char* dove::get_type_name(hwcom_type type) {
+  switch (type) {
+    case HOST:      return "nodes";
+    case SOCKET:    return "processors";
+    case CORE:      return "cores";
+    case HW_THREAD: return "hw-threads";
+    default:        return "unknown";
+  }
+}
+
+dove::hwcom_type dove::parse_type_name(const char* name) {
+  if (strcmp(name, "nodes") == 0)
+    return HOST;
+  if (strcmp(name, "processors") == 0)
+    return SOCKET;
+  if (strcmp(name, "cores") == 0)
+    return CORE;
+  if (strcmp(name, "hw-threads") == 0)
+    return HW_THREAD;
+  throw "The provided mapping was not recognized. Use one of cores,nodes,processors,hw-threads";
+}
+
+const char* dove::get_strategy_name(selection_strategy strategy) {
+  switch (strategy) {
+    case SELECT_FIRST:       return "first";
+    case SELECT_COMPACT:     return "compact";
+    case SELECT_SCATTER:     return "scatter";
+    case SELECT_MIN_LATENCY: return "latency";
+    default:                 return "unknown";
+  }
+}
+
+dove::selection_strategy dove::parse_strategy(const char* name) {
+  if (strcmp(name, "first") == 0)
+    return SELECT_FIRST;
+  if (strcmp(name, "compact") == 0)
+    return SELECT_COMPACT;
+  if (strcmp(name, "scatter") == 0)
+    return SELECT_SCATTER;
+  if (strcmp(name, "latency") == 0)
+    return SELECT_MIN_LATENCY;
+  throw "Unknown selection strategy. Valid values are first,compact,scatter,latency";
+}
+
+// Fills table[from * N + to] with the profiled delay between every pair
+// of the given logical IDs and marks each pair that was found. If a pair
+// was profiled more than once, the first value wins
+static void read_routing_delays(rapidxml::xml_document<char>* system,
+    const std::vector<int> &ids, long* table, std::vector<bool> &found) {
+  int units = ids.size();
+  std::fill(table, table + units * units, 0);
+  found.assign(units * units, false);
+  if (units < 2)
+    return;
+
+  // Dense logical ID --> 0...N-1 index, so that each <d> tag is
+  // matched against the units with two array loads
+  int max_logical_id = *std::max_element(ids.begin(), ids.end());
+  std::vector<int> index_of(max_logical_id + 1, -1);
+  for (int u = 0; u < units; u++)
+    index_of[ids[u]] = u;
+
+  rapidxml::xml_node<>* delays = system->first_node("system")->
+    last_node("routing_delays");
+  if (delays == 0)
+    throw "system.xml contains no routing_delays, please profile the system first";
+
+  for (rapidxml::xml_node<char> *delay = delays->first_node("d");
+      delay;
+      delay = delay->next_sibling("d")) {
+    int lfrom = atoi(delay->first_attribute("f")->value());
+    int lto = atoi(delay->first_attribute("t")->value());
+    if (lfrom < 0 || lfrom > max_logical_id || index_of[lfrom] < 0 ||
+        lto < 0 || lto > max_logical_id || index_of[lto] < 0)
+      continue;
+
+    int cell = index_of[lfrom] * units + index_of[lto];
+    if (found[cell])
+      continue;
+    table[cell] = atol(delay->first_attribute("v")->value());
+    found[cell] = true;
+  }
+}
+
+// Fills table[from * N + to] with the bandwidth in bytes per second 
+// from the b attribute (MB/s) of the <d> tag between every pair of the
+// given logical IDs, or 0 if it has none. The first <d> tag for a pair 
+// wins, as for delays
+static void read_bandwidths(rapidxml::xml_document<char>* system,
+    const std::vector<int> &ids, double* table) {
+  int units = ids.size();
+  std::fill(table, table + units * units, 0.0);
+  if (units < 2)
+    return;
+
+  int max_logical_id = *std::max_element(ids.begin(), ids.end());
+  std::vector<int> index_of(max_logical_id + 1, -1);
+  for (int u = 0; u < units; u++)
+    index_of[ids[u]] = u;
+
+  rapidxml::xml_node<>* delays = system->first_node("system")->
+    last_node("routing_delays");
+  if (delays == 0)
+    return;
+
+  std::vector<bool> found(units * units, false);
+  for (rapidxml::xml_node<char> *delay = delays->first_node("d");
+      delay;
+      delay = delay->next_sibling("d")) {
+    int lfrom = atoi(delay->first_attribute("f")->value());
+    int lto = atoi(delay->first_attribute("t")->value());
+    if (lfrom < 0 || lfrom > max_logical_id || index_of[lfrom] < 0 ||
+        lto < 0 || lto > max_logical_id || index_of[lto] < 0)
+      continue;
+
+    int cell = index_of[lfrom] * units + index_of[lto];
+    if (found[cell])
+      continue;
+    found[cell] = true;
+    rapidxml::xml_attribute<char>* b = delay->first_attribute("b");
+    if (b != 0)
+      table[cell] = atof(b->value()) * 1000000.0;
+  }
+}
+
+// Logical IDs of the cores that make up a socket or host
+static std::vector<int> cores_within(const dove::system_index &index,
+    const dove::hwcom &com) {
+  std::vector<int> within;
+  const std::vector<int> &cores = index.get_ids(dove::CORE);
+  for (int c = 0; c < cores.size(); c++) {
+    const dove::hwcom &core = index.get(cores[c]);
+    if ((com.type == dove::SOCKET && core.proc_id == com.id) ||
+        (com.type == dove::HOST && core.node_id == com.id))
+      within.push_back(cores[c]);
+  }
+  return within;
+}
+
+// Like read_routing_delays, but usable for every type of unit. A pair 
+// with no <d> tag of its own falls back to what was profiled for the 
+// cores holding it: hardware threads use the delay between their cores
+// (0 between siblings on one core), and sockets and hosts use the 
+// average delay between the cores they contain
+static void resolve_routing_delays(rapidxml::xml_document<char>* system,
+    const dove::system_index &index, const std::vector<int> &ids, 
+    long* table, std::vector<bool> &found) {
+  int units = ids.size();
+  std::vector<std::vector<int> > fallback(units);
+  std::vector<int> probe(ids);
+  std::map<int, int> probe_at;
+  for (int u = 0; u < units; u++)
+    probe_at[ids[u]] = u;
+
+  for (int u = 0; u < units; u++) {
+    const dove::hwcom &com = index.get(ids[u]);
+    if (com.type == dove::HW_THREAD)
+      fallback[u].push_back(com.core_id);
+    else if (com.type == dove::SOCKET || com.type == dove::HOST)
+      fallback[u] = cores_within(index, com);
+    for (int f = 0; f < fallback[u].size(); f++)
+      if (probe_at.find(fallback[u][f]) == probe_at.end()) {
+        probe_at[fallback[u][f]] = probe.size();
+        probe.push_back(fallback[u][f]);
+      }
+  }
+
+  int size = probe.size();
+  std::vector<long> probed(size * size);
+  std::vector<bool> probe_found;
+  read_routing_delays(system, probe, probed.data(), probe_found);
+
+  std::fill(table, table + units * units, 0);
+  found.assign(units * units, false);
+  for (int a = 0; a < units; a++)
+    for (int b = 0; b < units; b++) {
+      int cell = a * units + b;
+      if (a == b || probe_found[a * size + b]) {
+        table[cell] = probed[a * size + b];
+        found[cell] = true;
+        continue;
+      }
+
+      long total = 0;
+      int pairs = 0;
+      for (int fa = 0; fa < fallback[a].size(); fa++)
+        for (int fb = 0; fb < fallback[b].size(); fb++) {
+          int pa = probe_at[fallback[a][fa]];
+          int pb = probe_at[fallback[b][fb]];
+          if (pa == pb) {
+            // Sibling hardware threads
+            pairs++;
+          } else if (probe_found[pa * size + pb]) {
+            total += probed[pa * size + pb];
+            pairs++;
+          }
+        }
+      if (pairs != 0) {
+        table[cell] = (total + pairs / 2) / pairs;
+        found[cell] = true;
+      }
+    }
+}
+
+// Groups candidates by host, and within each host by socket, keeping the
+// order of system.xml. Components that are not inside a socket (hosts) 
+// form a single group
+typedef std::vector<std::vector<int> > id_groups;
+static std::vector<id_groups> group_by_host(const dove::system_index &index,
+    const std::vector<int> &candidates) {
+  std::vector<id_groups> hosts;
+  std::map<int, int> host_at;
+  std::map<int, std::pair<int, int> > socket_at;
+  for (int c = 0; c < candidates.size(); c++) {
+    const dove::hwcom &com = index.get(candidates[c]);
+    if (host_at.find(com.node_id) == host_at.end()) {
+      host_at[com.node_id] = hosts.size();
+      hosts.push_back(id_groups());
+    }
+    int h = host_at[com.node_id];
+    if (socket_at.find(com.proc_id) == socket_at.end() ||
+        socket_at[com.proc_id].first != h) {
+      socket_at[com.proc_id] = std::make_pair(h, (int) hosts[h].size());
+      hosts[h].push_back(std::vector<int>());
+    }
+    hosts[h][socket_at[com.proc_id].second].push_back(candidates[c]);
+  }
+  return hosts;
+}
+
+// Returns the position of the first group holding at least need IDs, or
+// of the largest group if none are big enough
+template <typename T>
+static int best_fit(const std::vector<T> &groups, 
+    const std::vector<int> &sizes, int need) {
+  int largest = 0;
+  for (int g = 0; g < groups.size(); g++) {
+    if (sizes[g] >= need)
+      return g;
+    if (sizes[g] > sizes[largest])
+      largest = g;
+  }
+  return largest;
+}
+
+// Fills as few sockets, and then hosts, as possible. Picks the first
+// host (and socket) that can hold all remaining units, otherwise the 
+// largest one, and repeats until enough units are chosen
+static std::vector<int> select_compact(const dove::system_index &index,
+    const std::vector<int> &candidates, int count) {
+  std::vector<id_groups> hosts = group_by_host(index, candidates);
+  std::vector<int> chosen;
+  while (chosen.size() < count) {
+    int need = count - chosen.size();
+    std::vector<int> host_sizes;
+    for (int h = 0; h < hosts.size(); h++) {
+      int size = 0;
+      for (int s = 0; s < hosts[h].size(); s++)
+        size += hosts[h][s].size();
+      host_sizes.push_back(size);
+    }
+    int h = best_fit(hosts, host_sizes, need);
+    id_groups sockets = hosts[h];
+    hosts.erase(hosts.begin() + h);
+
+    while (!sockets.empty() && chosen.size() < count) {
+      need = count - chosen.size();
+      std::vector<int> socket_sizes;
+      for (int s = 0; s < sockets.size(); s++)
+        socket_sizes.push_back(sockets[s].size());
+      int s = best_fit(sockets, socket_sizes, need);
+      for (int u = 0; u < sockets[s].size() && chosen.size() < count; u++)
+        chosen.push_back(sockets[s][u]);
+      sockets.erase(sockets.begin() + s);
+    }
+  }
+  return chosen;
+}
+
+// Deals units out one at a time to each socket, alternating between 
+// hosts, so that consecutive units land on different hosts and then
+// different sockets. Within a socket, hardware threads are dealt from
+// different cores before any core gets a second thread
+static std::vector<int> select_scatter(const dove::system_index &index,
+    const std::vector<int> &candidates, int count) {
+  std::vector<id_groups> hosts = group_by_host(index, candidates);
+
+  std::vector<std::vector<int> > queues;
+  for (int round = 0; ; round++) {
+    bool added = false;
+    for (int h = 0; h < hosts.size(); h++)
+      if (round < hosts[h].size()) {
+        queues.push_back(hosts[h][round]);
+        added = true;
+      }
+    if (!added)
+      break;
+  }
+
+  // Order each socket by how many siblings precede a unit in its core
+  for (int q = 0; q < queues.size(); q++) {
+    std::map<int, int> seen_in_core;
+    std::vector<std::pair<int, int> > order;
+    for (int u = 0; u < queues[q].size(); u++) {
+      int core = index.get(queues[q][u]).core_id;
+      int sibling = core < 0 ? 0 : seen_in_core[core]++;
+      order.push_back(std::make_pair(sibling, u));
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<int> sorted;
+    for (int u = 0; u < order.size(); u++)
+      sorted.push_back(queues[q][order[u].second]);
+    queues[q] = sorted;
+  }
+
+  std::vector<int> chosen;
+  for (int round = 0; chosen.size() < count; round++)
+    for (int q = 0; q < queues.size() && chosen.size() < count; q++)
+      if (round < queues[q].size())
+        chosen.push_back(queues[q][round]);
+  return chosen;
+}
+
+// Greedily grows a set from every candidate in turn, each time adding the
+// unit with the smallest delay to and from the units already chosen, and
+// keeps the grown set with the smallest total pairwise delay. This is an
+// approximation: the set with the smallest total over all choices of 
+// count units may not be found. Each of the size seeds grows in count 
+// steps of O(size), so the cost is O(size^2 * count) after the O(size^2)
+// delay table. Pairs that were never profiled are never chosen together
+static std::vector<int> select_min_latency(rapidxml::xml_document<char>* system,
+    const dove::system_index &index, const std::vector<int> &candidates, 
+    int count) {
+  int size = candidates.size();
+  std::vector<long> table(size * size);
+  std::vector<bool> found;
+  resolve_routing_delays(system, index, candidates, table.data(), found);
+
+  const long unreachable = -1;
+  std::vector<long> cost(size * size, unreachable);
+  for (int a = 0; a < size; a++)
+    for (int b = 0; b < size; b++)
+      if (a == b)
+        cost[a * size + b] = 0;
+      else if (found[a * size + b] && found[b * size + a])
+        cost[a * size + b] = table[a * size + b] + table[b * size + a];
+
+  std::vector<int> best;
+  long best_total = 0;
+  for (int seed = 0; seed < size; seed++) {
+    std::vector<int> set(1, seed);
+    std::vector<bool> in_set(size, false);
+    in_set[seed] = true;
+    std::vector<long> cost_to_set(cost.begin() + seed * size,
+        cost.begin() + (seed + 1) * size);
+    long total = 0;
+
+    while (set.size() < count) {
+      int next = -1;
+      for (int c = 0; c < size; c++)
+        if (!in_set[c] && cost_to_set[c] != unreachable &&
+            (next < 0 || cost_to_set[c] < cost_to_set[next]))
+          next = c;
+      if (next < 0)
+        break;
+      set.push_back(next);
+      in_set[next] = true;
+      total += cost_to_set[next];
+      for (int c = 0; c < size; c++)
+        if (cost_to_set[c] != unreachable)
+          cost_to_set[c] = cost[next * size + c] == unreachable ? 
+            unreachable : cost_to_set[c] + cost[next * size + c];
+    }
+
+    if (set.size() == count && (best.empty() || total < best_total)) {
+      best = set;
+      best_total = total;
+    }
+  }
+  if (best.empty())
+    throw "No set of compute units has routing delays between every pair";
+
+  // Keep the units in system.xml order
+  std::sort(best.begin(), best.end());
+  std::vector<int> chosen;
+  for (int u = 0; u < best.size(); u++)
+    chosen.push_back(candidates[best[u]]);
+  return chosen;
+}
+
 dove::hwprofile::hwprofile(hwcom_type type, int compute_units, 
-    rapidxml::xml_document<char>* system) {
+    rapidxml::xml_document<char>* system,
+    selection_strategy strategy) {
   xdebug("Creating new hardware profile");
  
   system_ = system;
   type_ = type;
+  strategy_ = strategy;
+  delays_ = 0;
 
-  std::vector<rapidxml::xml_node<char>*> nodes;
-  switch (type) {
-    case HOST: 
-      throw "Only cores are supported";
+  if (type != HOST && type != PROC && type != CORE && type != HW_THREAD)
+    throw "Hardware component type must be know to create a hardware profile";
+
+  system_index index(*system_);
+  const std::vector<int> &candidates = index.get_ids(type);
+  if (candidates.size() < compute_units)
+    throw "There are not enough available compute units";
+
+  info("Choosing compute units");
+  switch (strategy) {
+    case SELECT_FIRST:
+      ids_.assign(candidates.begin(), candidates.begin() + compute_units);
       break;
-    case PROC:
-      throw "Only cores are supported";
+    case SELECT_COMPACT:
+      ids_ = select_compact(index, candidates, compute_units);
       break;
-    case CORE:
-      info("Getting all cores");
-      nodes = get_all_cores(*system_);
-      info("Done getting cores");
+    case SELECT_SCATTER:
+      ids_ = select_scatter(index, candidates, compute_units);
       break;
-    case HW_THREAD:
-      throw "Only cores are supported";
+    case SELECT_MIN_LATENCY:
+      ids_ = select_min_latency(system_, index, candidates, compute_units);
       break;
     default:
-      throw "Hardware component type must be know to create a hardware profile";
-      break;
-  }
-  
-  // Our first 'strategy' for choosing the components is quite 
-  // simple: whichever ones appear first in the XML ;-)
-  if (nodes.size() < compute_units)
-    throw "There are not enough available compute units";
-  info("Choosing cores");
-  for (int u = 0; u < compute_units; u++) {
-    char* logid_str = nodes[u]->first_attribute("id")->value();
-    std::istringstream stream(logid_str);
-    int logid;
-    stream >> logid;
-    ids_[u] = logid;
+      throw "Unknown selection strategy";
   }
+
+  build_routing_delays(index);
+  build_execution_speeds(index);
+  build_bandwidths();
 }
 
-int dove::hwprofile::get_logical_id(int id) {
-  if (id >= ids_.size() || id < 0)
-    throw "Invalid ID passed to get_logical_id";
-  return ids_[id];
+dove::hwprofile::~hwprofile() {
+  free(delays_);
 }
 
-long dove::hwprofile::get_routing_delay(int from, int to) {
-  int lfrom = get_logical_id(from);
-  int lto = get_logical_id(to);
-  if (lfrom == lto)
-    return 0;
-  rapidxml::xml_node<>* system = system_->first_node("system");
-  //if (system != 0)
-  //  info("Got system");
-  //else
-  //  info("Tried to fetch system, but it was not returned");
-  rapidxml::xml_node<>* delays = system->last_node("routing_delays");
-  if (delays == 0)
-    info("Delays does not exist, expect segfaults next!");
-
-  for (rapidxml::xml_node<char> *delay = 
-        delays->first_node(); 
-        delay; 
-        delay = delay->next_sibling()) {
-    char* sfrom = delay->first_attribute("f")->value();
-    std::istringstream ssfrom(sfrom);
-    int from;
-    ssfrom >> from;
-    if (from != lfrom) 
-      continue;
-    char* sto = delay->first_attribute("t")->value();
-    std::istringstream ssto(sto);
-    int to;
-    ssto >> to;
-    if (to == lto) {
-      char* sval = delay->first_attribute("v")->value();
-      std::istringstream ssval(sval);
-      int val;
-      ssval >> val;
-      return val;
-    }
+void dove::hwprofile::build_execution_speeds(const system_index &index) {
+  xdebug("Reading execution speeds");
+  speeds_.assign(ids_.size(), 0);
+  double fastest = 0;
+  for (int u = 0; u < ids_.size(); u++) {
+    speeds_[u] = index.get(ids_[u]).speed;
+    fastest = std::max(fastest, speeds_[u]);
   }
 
-  throw "No route was found between the two id's";
+  // Units with no speed are assumed to match the fastest unit
+  for (int u = 0; u < speeds_.size(); u++)
+    speeds_[u] = (fastest == 0 || speeds_[u] <= 0) ? 1.0 : 
+      speeds_[u] / fastest;
 }
-      
-char* dove::deployment::s(const char* unsafe) {
-  return system_->allocate_string(unsafe);
+
+void dove::hwprofile::build_bandwidths() {
+  xdebug("Reading bandwidths");
+  bandwidths_.resize(ids_.size() * ids_.size());
+  read_bandwidths(system_, ids_, bandwidths_.data());
 }
 
-char* dove::deployment::s(std::string unsafe) {
-  return system_->allocate_string(unsafe.c_str());
+void dove::hwprofile::build_routing_delays(const system_index &index) {
+  xdebug("Building routing delay table");
+  int units = ids_.size();
+  void* buffer = 0;
+  if (posix_memalign(&buffer, routing_matrix_alignment, 
+        std::max(units * units, 1) * sizeof(long)) != 0)
+    throw "Unable to allocate the routing delay table";
+  delays_ = (long*) buffer;
+
+  std::vector<bool> found;
+  resolve_routing_delays(system_, index, ids_, delays_, found);
+
+  bool missing = false;
+  for (int from = 0; from < units; from++)
+    for (int to = 0; to < units; to++) {
+      if (from == to || found[from * units + to])
+        continue;
+      std::ostringstream msg;
+      msg << "No routing delay in system.xml from logical ID " 
+        << ids_[from] << " to logical ID " << ids_[to];
+      error(msg.str().c_str());
+      missing = true;
+    }
+  if (missing)
+    throw "system.xml is missing routing delays between the chosen compute units";
 }
 
-char* dove::deployment::s(int unsafe) {
-  std::stringstream st;
-  st << unsafe;
-  return s(st.str().c_str());
-} 
+int dove::hwprofile::get_logical_id(int id) {
+  if (id >= ids_.size() || id < 0)
+    throw "Invalid ID passed to get_logical_id";
+  return ids_[id];
+}
+      
+char* dove::deployment::s(const char* unsafe) const {
+  return deployments_->allocate_string(unsafe);
+}
 
 dove::deployment::deployment(hwprofile* prof, 
     rapidxml::xml_document<char>* system,
-    rapidxml::xml_document<char>* deployment) {
+    rapidxml::xml_document<char>* deployment,
+    int tasks) {
   //xdebug("Creating new deployment");
   profile = prof;
   system_ = system;
   deployments_ = deployment;
+  units_.assign(tasks, -1);
+  order_.reserve(tasks);
+  metric_count_ = 0;
 }
 
-node* dove::deployment::get_xml() {
+// Large enough for any int, long, or double printed with %.19f
+static const int metric_chars = 352;
+
+const char* dove::deployment::format(const metric &m, char* buf, int size) {
+  switch (m.type) {
+    case metric::INTEGER:
+      snprintf(buf, size, "%ld", m.integer);
+      return buf;
+    case metric::REAL:
+      snprintf(buf, size, "%.19f", m.real);
+      return buf;
+    default:
+      return m.text.c_str();
+  }
+}
+
+node* dove::deployment::get_xml() const {
   //xdebug("Getting XML for deployment");
-  node* deployment_xml = system_->allocate_node(rapidxml::node_element,
+  node* deployment_xml = deployments_->allocate_node(rapidxml::node_element,
       s("deployment"));
   
-  std::vector<std::pair<int, int> >::iterator it;
-  for (it = plan.begin();
-      it != plan.end();
-      it++) {
+  char buf[metric_chars];
+  for (int i = 0; i < order_.size(); i++) {
     node* deploy = deployments_->allocate_node(rapidxml::node_element, 
         s("deploy"));
-    attr* task = deployments_->allocate_attribute(s("t"), s((*it).first));
-    attr* unit = deployments_->allocate_attribute(s("u"), s((*it).second));
+    snprintf(buf, sizeof(buf), "%d", order_[i]);
+    attr* task = deployments_->allocate_attribute(s("t"), s(buf));
+    snprintf(buf, sizeof(buf), "%d", units_[order_[i]]);
+    attr* unit = deployments_->allocate_attribute(s("u"), s(buf));
     deploy->append_attribute(task);
     deploy->append_attribute(unit);
     deployment_xml->append_node(deploy);
   }
 
-  std::map<std::string, std::string>::iterator it2;
-  for (it2 = metrics.begin();
-      it2 != metrics.end();
-      it2++) {
+  for (int i = 0; i < metric_count_; i++) {
     node* metric = deployments_->allocate_node(rapidxml::node_element, 
         s("metric"));
-    attr* name = deployments_->allocate_attribute(s("name"), s(it2->first));
-    attr* value = deployments_->allocate_attribute(s("value"), s(it2->second));
+    attr* name = deployments_->allocate_attribute(s("name"), 
+        s(metrics_[i].name.c_str()));
+    attr* value = deployments_->allocate_attribute(s("value"), 
+        s(format(metrics_[i], buf, sizeof(buf))));
     metric->append_attribute(name);
     metric->append_attribute(value);
     deployment_xml->append_node(metric);
@@ -395,32 +925,123 @@ node* dove::deployment::get_xml() {
   return deployment_xml;
 }
 
+// Appends a quoted attribute value, escaped and quoted the same way 
+// rapidxml::print does: values containing " are single quoted
+static void append_quoted(std::string &out, const std::string &value) {
+  char quote = value.find('"') == std::string::npos ? '"' : '\'';
+  out += quote;
+  for (std::string::const_iterator c = value.begin(); c != value.end(); ++c)
+    if (*c == quote)
+      out += quote == '"' ? "&quot;" : "&apos;";
+    else
+      switch (*c) {
+        case '<': out += "&lt;"; break;
+        case '>': out += "&gt;"; break;
+        case '&': out += "&amp;"; break;
+        default: out += *c; break;
+      }
+  out += quote;
+}
+
+static void append_int(std::string &out, int value) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d", value);
+  out += buf;
+}
+
+void dove::deployment::print(std::string &out, int id) const {
+  out += "\t\t<deployment id=\"";
+  append_int(out, id);
+  out += "\">\n";
+
+  for (int i = 0; i < order_.size(); i++) {
+    out += "\t\t\t<deploy t=\"";
+    append_int(out, order_[i]);
+    out += "\" u=\"";
+    append_int(out, units_[order_[i]]);
+    out += "\"/>\n";
+  }
+
+  char buf[metric_chars];
+  for (int i = 0; i < metric_count_; i++) {
+    out += "\t\t\t<metric name=";
+    append_quoted(out, metrics_[i].name);
+    out += " value=";
+    if (metrics_[i].type == metric::TEXT)
+      append_quoted(out, metrics_[i].text);
+    else {
+      out += '"';
+      out += format(metrics_[i], buf, sizeof(buf));
+      out += '"';
+    }
+    out += "/>\n";
+  }
+  out += "\t\t</deployment>\n";
+}
+
+void dove::deployment::clear() {
+  for (int i = 0; i < order_.size(); i++)
+    units_[order_[i]] = -1;
+  order_.clear();
+  metric_count_ = 0;
+}
+
 void dove::deployment::add_task_deployment(int task, int hardware) { 
   // TODO handle exceptions here if the hardware id is bad
   int logical_id = profile->get_logical_id(hardware);
-  std::pair<int, int> map = std::make_pair (task, logical_id);
-  plan.push_back(map);
+  if (task >= (int) units_.size())
+    units_.resize(task + 1, -1);
+  if (units_[task] == -1)
+    order_.push_back(task);
+  units_[task] = logical_id;
+}
+
+dove::deployment::metric& dove::deployment::set_metric(const char* name) {
+  int at = 0;
+  while (at < metric_count_ && metrics_[at].name.compare(name) < 0)
+    at++;
+  if (at < metric_count_ && metrics_[at].name.compare(name) == 0)
+    return metrics_[at];
+
+  // Move a free slot (or a new one) into place, so the names stay sorted
+  if (metric_count_ == metrics_.size())
+    metrics_.push_back(metric());
+  std::rotate(metrics_.begin() + at, metrics_.begin() + metric_count_,
+      metrics_.begin() + metric_count_ + 1);
+  metric_count_++;
+  metrics_[at].name.assign(name);
+  return metrics_[at];
 }
 
-void dove::deployment::add_metric(std::string name, std::string value) {
-  metrics[name] = value;
+void dove::deployment::add_metric(const std::string &name, 
+    const std::string &value) {
+  add_metric(name.c_str(), value.c_str());
 }
 
 void dove::deployment::add_metric(const char* name, const char* value) {
-  std::string n(name);
-  std::string v(value);
-  add_metric(n, v);
+  metric &m = set_metric(name);
+  m.type = metric::TEXT;
+  m.text.assign(value);
 }
 
-void dove::deployment::add_metric(const char* name, std::string value) {
-  std::string n(name);
-  add_metric(n, value);
+void dove::deployment::add_metric(const char* name, const std::string &value) {
+  add_metric(name, value.c_str());
 }
+
 void dove::deployment::add_metric(const char* name, int value) {
-  std::string n(name);
-  std::ostringstream val;
-  val << value;
-  add_metric(n, val.str());
+  add_metric(name, (long) value);
+}
+
+void dove::deployment::add_metric(const char* name, long value) {
+  metric &m = set_metric(name);
+  m.type = metric::INTEGER;
+  m.integer = value;
+}
+
+void dove::deployment::add_metric(const char* name, double value) {
+  metric &m = set_metric(name);
+  m.type = metric::REAL;
+  m.real = value;
 }
 
 
@@ -428,16 +1049,141 @@ char* dove::validator::s(const char* unsafe) {
   return system_->allocate_string(unsafe);
 }
 
+// Multiple-producer single-consumer queue behind submit_deployment.
+// Producers copy the deployment into an item and push it onto a stack,
+// and the writer thread takes the whole stack at once, reverses it into
+// arrival order and hands each deployment to add_deployment. The stack
+// is only touched under lock_, which is held for a few pointer moves;
+// copying and all XML and disk work happen outside it. Written items go 
+// back onto a free list, and a recycled item is assigned the next 
+// deployment, which reuses its vectors and strings, so once warmed up a
+// push does not allocate
+class dove::deployment_queue {
+  struct item {
+    deployment d;
+    item* next;
+    item(const deployment &dep) : d(dep), next(0) { }
+  };
+
+  validator* owner_;
+  std::mutex lock_;
+  // The writer sleeps on this until there are items or it is stopping
+  std::condition_variable wake_;
+  // Everything below is guarded by lock_
+  item* head_;
+  // Items the writer has finished with
+  item* spare_;
+  bool stopping_;
+  std::thread writer_;
+
+  void run() {
+    for (;;) {
+      item* batch;
+      {
+        std::unique_lock<std::mutex> lock(lock_);
+        wake_.wait(lock, [this]() { return head_ != 0 || stopping_; });
+        batch = head_;
+        head_ = 0;
+      }
+      // Only empty once stopping, and nothing can be pushed after that
+      if (batch == 0)
+        return;
+
+      item* ordered = 0;
+      while (batch != 0) {
+        item* next = batch->next;
+        batch->next = ordered;
+        ordered = batch;
+        batch = next;
+      }
+      item* last = ordered;
+      for (item* it = ordered; it != 0; it = it->next) {
+        owner_->add_deployment(it->d);
+        last = it;
+      }
+      std::lock_guard<std::mutex> lock(lock_);
+      last->next = spare_;
+      spare_ = ordered;
+    }
+  }
+
+  static void free_items(item* it) {
+    while (it != 0) {
+      item* next = it->next;
+      delete it;
+      it = next;
+    }
+  }
+
+  public:
+    deployment_queue(validator* owner) : owner_(owner), head_(0), 
+      spare_(0), stopping_(false) { }
+
+    ~deployment_queue() {
+      finish();
+      free_items(head_);
+      free_items(spare_);
+    }
+
+    // throws exception if called after finish
+    void push(const deployment &d) {
+      item* it = 0;
+      {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (stopping_)
+          throw "submit_deployment was called after complete";
+        if (spare_ != 0) {
+          it = spare_;
+          spare_ = it->next;
+        }
+        if (!writer_.joinable())
+          writer_ = std::thread(&deployment_queue::run, this);
+      }
+      if (it == 0)
+        it = new item(d);
+      else
+        it->d = d;
+      {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (stopping_) {
+          it->next = spare_;
+          spare_ = it;
+          throw "submit_deployment was called after complete";
+        }
+        it->next = head_;
+        head_ = it;
+      }
+      wake_.notify_one();
+    }
+
+    // Writes everything that was pushed, then stops the writer. Pushes
+    // are rejected from here on
+    void finish() {
+      {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopping_ = true;
+      }
+      wake_.notify_one();
+      if (writer_.joinable())
+        writer_.join();
+    }
+};
+
 dove::validator::validator(int tasks, 
         int compute_units,
         hwcom_type compute_type,
         const char* deployment_output_filename,
         const char* algorithm_name,
         const char* system_xml_path,
-        const char* algorithm_desc) {
+        const char* algorithm_desc,
+        selection_strategy strategy) {
   xdebug("Creating new deployment_optimization 1");
 
   number_deployments_ = 0;
+  queue_ = new deployment_queue(this);
+  stream_ = 0;
+  flush_interval_ = 0;
+  stream_end_ = 0;
 
   // TODO I need to copy all of the char* i receive into my own memory, as 
   // simply copying the pointer to that memory likely means that it will 
@@ -450,7 +1196,7 @@ dove::validator::validator(int tasks,
   system_ = new rapidxml::xml_document<char>();
   system_->parse<0>(xmldata->data());
   info("Storing system.xml into system_");
-  profile = new hwprofile(compute_type, compute_units, system_);
+  profile = new hwprofile(compute_type, compute_units, system_, strategy);
   
   info("Creating header for deployments");
   deployment_ = new rapidxml::xml_document<char>();
@@ -460,21 +1206,44 @@ dove::validator::validator(int tasks,
   root->append_attribute(name);
   attr *desc = deployment_->allocate_attribute(s("desc"), s(algorithm_desc));
   root->append_attribute(desc);
+  // Records which units the logical IDs in the deployments refer to
+  node *mapping = deployment_->allocate_node(rapidxml::node_element, s("mapping"));
+  root->append_node(mapping);
+  attr *to = deployment_->allocate_attribute(s("to"), s(get_type_name(compute_type)));
+  mapping->append_attribute(to);
+  attr *strat = deployment_->allocate_attribute(s("strategy"), 
+      s(get_strategy_name(strategy)));
+  mapping->append_attribute(strat);
   node *deployments = deployment_->allocate_node(rapidxml::node_element, s("deployments"));
   root->append_node(deployments);
 
   xdebug("Done creating deployment_optimization");
 }
 
-long dove::validator::get_routing_delay(int from, int to) {
-  return profile->get_routing_delay(from, to);
+dove::validator::~validator() {
+  // Stops and joins the writer, in case complete() was never called
+  delete queue_;
+  // Likewise, a stream is given its last flush so the file is complete
+  if (stream_ != 0) {
+    flush_pending();
+    stream_->close();
+    delete stream_;
+  }
 }
 
 dove::deployment dove::validator::get_empty_deployment() {
-  return deployment(profile, system_, deployment_);
+  return deployment(profile, system_, deployment_, task_count);
 }
 
-void dove::validator::add_deployment(deployment d) {
+void dove::validator::add_deployment(const deployment &d) {
+  if (stream_ != 0) {
+    d.print(pending_, number_deployments_);
+    number_deployments_++;
+    if (number_deployments_ % flush_interval_ == 0)
+      flush_pending();
+    return;
+  }
+
   node* deps = deployment_->first_node("optimization")->
     first_node("deployments");
   node* deployment = d.get_xml();
@@ -487,8 +1256,70 @@ void dove::validator::add_deployment(deployment d) {
   deps->append_node(deployment);
 }
 
+void dove::validator::submit_deployment(const deployment &d) {
+  queue_->push(d);
+}
+
+// Closes the elements opened by stream_deployments
+static const char* stream_footer = "\t</deployments>\n</optimization>\n\n";
+
+void dove::validator::stream_deployments(int flush_interval) {
+  if (number_deployments_ != 0)
+    throw "stream_deployments must be called before any deployment is added";
+  if (stream_ != 0)
+    return;
+
+  stream_ = new std::ofstream(deployment_filename.c_str(),
+      std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!stream_->is_open()) {
+    error("Unable to save file to following location: ");
+    error(deployment_filename.c_str());
+    delete stream_;
+    stream_ = 0;
+    throw "Unable to open deployments file for streaming";
+  }
+  flush_interval_ = flush_interval > 0 ? flush_interval : 1;
+
+  node* root = deployment_->first_node("optimization");
+  pending_ = "<optimization name=";
+  append_quoted(pending_, root->first_attribute("name")->value());
+  pending_ += " desc=";
+  append_quoted(pending_, root->first_attribute("desc")->value());
+  pending_ += ">\n";
+  node* mapping = root->first_node("mapping");
+  pending_ += "\t<mapping to=";
+  append_quoted(pending_, mapping->first_attribute("to")->value());
+  pending_ += " strategy=";
+  append_quoted(pending_, mapping->first_attribute("strategy")->value());
+  pending_ += "/>\n\t<deployments>\n";
+  flush_pending();
+}
+
+void dove::validator::flush_pending() {
+  stream_->seekp(stream_end_);
+  stream_->write(pending_.data(), pending_.size());
+  stream_end_ += pending_.size();
+  // Keeps its capacity, so steady-state streaming does not allocate
+  pending_.clear();
+
+  // Leave the file well formed, the next flush overwrites the footer
+  *stream_ << stream_footer;
+  stream_->flush();
+}
+
 void dove::validator::complete() {
   xdebug("Complete was called on deployment_optimization");
+  queue_->finish();
+  if (stream_ != 0) {
+    flush_pending();
+    stream_->close();
+    delete stream_;
+    stream_ = 0;
+    info("File written");
+    info(deployment_filename.c_str());
+    return;
+  }
+
   std::ofstream output(deployment_filename.c_str(), 
       std::ios::out | std::ios::trunc);
   if (output.is_open())
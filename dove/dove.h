@@ -13,6 +13,11 @@ namespace rapidxml {
 #include <vector>
 #include <string>
 #include <map>
+#include <unordered_map>
+
+#ifndef DOVE_MAX_LOG_LEVEL
+#define DOVE_MAX_LOG_LEVEL 999
+#endif
 
 typedef rapidxml::xml_node<char> xml_node;
 typedef rapidxml::xml_node<char> node;
@@ -57,6 +62,32 @@ namespace dove {
     UNKNOWN   = 0
   };
 
+  // Converts between a type and the name used for it in 
+  // deployments.xml (nodes, processors, cores or hw-threads).
+  // parse_type_name throws if the name is unknown
+  const char* get_type_name(hwcom_type type);
+  hwcom_type parse_type_name(const char* name);
+
+  // Strategies a hwprofile can use to choose which of the available
+  // compute units in system.xml to expose to an algorithm
+  enum selection_strategy {
+    // Whichever units appear first in system.xml
+    SELECT_FIRST       = 0,
+    // Fill as few sockets, and then as few hosts, as possible
+    SELECT_COMPACT     = 1,
+    // Spread units across hosts first, then sockets, then cores
+    SELECT_SCATTER     = 2,
+    // A set with a small total profiled routing delay, grown greedily
+    // from each unit in turn. This approximates the smallest total, and
+    // costs O(candidates^2 * units)
+    SELECT_MIN_LATENCY = 3
+  };
+
+  // Converts between a strategy and its name (first, compact, scatter
+  // or latency). parse_strategy throws if the name is unknown
+  const char* get_strategy_name(selection_strategy strategy);
+  selection_strategy parse_strategy(const char* name);
+
   // Describes a hardware component using physical machine-specific IDs
   //
   // For high-level hardware construct such as host, there will be no 
@@ -70,31 +101,59 @@ namespace dove {
       std::string ip;
       hwcom_type type;
 
+      // Logical IDs of this component and of the host, socket, and core
+      // that hold it (-1 where they do not apply)
+      int id;
+      int node_id;
+      int proc_id;
+      int core_id;
+      // Clock speed in MHz of the enclosing socket (or first socket, for
+      // a host), or 0 if system.xml does not list it
+      double speed;
+      // Where this component is in an OpenMPI rankfile, i.e. the text
+      // after slot=. Sockets and hosts list every core they contain
+      std::string slot;
+      // Comma separated OS indices (pindex) of every hardware thread
+      // in this component, for pinning threads with sched_setaffinity
+      std::string cpus;
+
       hwcom(): node_pid(-1),
         proc_pid(-1), core_pid(-1),
         hwth_pid(-1), hostname(""),
-        ip(""), type(UNKNOWN) { }
+        ip(""), type(UNKNOWN),
+        id(-1), node_id(-1), proc_id(-1),
+        core_id(-1), speed(0) { }
+  };
+
+  // Indexes the <nodes> of a system.xml file in a single pass, so that 
+  // the hwcom of any logical ID can be found with one hash lookup 
+  // instead of a search of the XML tree. All strings are copied out of
+  // the document, so the index remains valid after it is deleted
+  class system_index {
+    std::unordered_map<int, hwcom> coms_;
+    // Logical IDs of every component of each type, in document order
+    std::vector<int> hosts_;
+    std::vector<int> sockets_;
+    std::vector<int> cores_;
+    std::vector<int> threads_;
+
+    public:
+      system_index(rapidxml::xml_document<char> &system);
+
+      // Returns the physical IDs of a logical hardware component.
+      //
+      // throws exception if the logical ID is not in system.xml
+      const hwcom& get(int logical_id) const;
+
+      bool contains(int logical_id) const {
+        return coms_.find(logical_id) != coms_.end();
+      }
+
+      // Returns the logical IDs of all components of one type, in the
+      // order they appear in system.xml
+      const std::vector<int>& get_ids(hwcom_type type) const;
   };
 
-  // Extracts physical IDs from the system.xml file for a logical hardware
-  // component ID. 
-  //
-  // Provides the minimal information needed to uniquely 
-  // identify that logical component (e.g. a if the logical_id is a processor, 
-  // no information on cores/threads will be provided)
-  // TODO move this into XML handling area
-  hwcom parse_pids(rapidxml::xml_document<char> &system, 
-      std::string logical_id);
-  void parse_pids(rapidxml::xml_document<char> &system, 
-      std::string logical_id,
-      int &node_pid, 
-      int &proc_pid, 
-      int &core_pid, 
-      int &hwth_pid, 
-      std::string &hostname, 
-      std::string &ip);
-  
-  
   // Returns a configuration string that will assign a task to a physical core
   //
   // Returns: One line of an OpenMPI rankfile
@@ -109,9 +168,9 @@ namespace dove {
   // or processor) and builds the rankline appropriately. If the ID is for an 
   // entire host, then the rankline lists that the task can be 
   // bound to any available processor on that host
-  std::string build_rankline(rapidxml::xml_document<char> &system,
+  std::string build_rankline(const system_index &system,
       int taskid, 
-      std::string logical_id);
+      int logical_id);
 
   std::vector<rapidxml::xml_node<char>*> get_all_hosts(
       rapidxml::xml_document<char> &system);
@@ -122,64 +181,184 @@ namespace dove {
   std::vector<rapidxml::xml_node<char>*> get_all_threads(
       rapidxml::xml_document<char> &system);
 
+  // The size of the message sent along one edge of the software model
+  struct edge_volume {
+    int from;
+    int to;
+    unsigned long long bytes;
+  };
+
+  // Reads the per-edge message sizes that accompany an STG, stored in a
+  // sidecar file (software.edges next to software.stg) with one 
+  // "<from task> <to task> <bytes>" line per edge. Blank lines and lines
+  // starting with # are skipped, and edges that are not listed carry no
+  // data. successors[t] lists the successors of task t in the STG, and 
+  // every edge in the file must be one of them. Returns no edges if the
+  // file does not exist.
+  //
+  // throws exception if a line cannot be parsed or names an edge that 
+  // is not in the STG
+  std::vector<edge_volume> read_edge_volumes(const char* path,
+      const std::vector<std::vector<unsigned int> > &successors);
+
+  // Path of the edge volume file for an STG: the STG path with its 
+  // extension replaced by .edges
+  std::string get_edges_path(const std::string &stg_path);
+
   // Represents a collection of hardware components. Used by algorithms to 
   // request N hardware components, where the components can be N cores, 
   // N processors, N machines, etc. 
   //
-  // Internally this uses a strategy to choose which of the available 
-  // physical components (e.g. out of all components listed in the 
-  // system.xml file) will be exposed to the optimization algorithm. 
+  // Internally this uses a selection_strategy to choose which of the 
+  // available physical components (e.g. out of all components listed in 
+  // the system.xml file) will be exposed to the optimization algorithm. 
   // The algorithm then uses this class to request information about the 
   // created hardware profile, such as querying the routing time between
   // two hardware components or the execution time. 
   class hwprofile {
     hwcom_type type_;
-    // Maps from 0...N to the actual logical ID
-    std::map<int, int> ids_;
+    selection_strategy strategy_;
+    // Maps from 0...N-1 to the actual logical ID
+    std::vector<int> ids_;
+    // Routing delays between the N chosen units, stored row-major so
+    // that delays_[from * N + to] is the delay from one unit to another.
+    // Built once from the <routing_delays> of system.xml into a buffer
+    // aligned to routing_matrix_alignment
+    long* delays_;
+    // Execution speed of each chosen unit relative to the fastest one
+    std::vector<double> speeds_;
+    // Bandwidth in bytes per second between the N chosen units, laid 
+    // out like delays_. 0 where system.xml gives no bandwidth
+    std::vector<double> bandwidths_;
     rapidxml::xml_document<char>* system_;
 
+    // Parses every <d> tag once and fills delays_. Pairs of threads, 
+    // sockets or hosts that were not profiled directly are derived from
+    // the delays between their cores. Throws if any pair of chosen units
+    // has no delay either way
+    void build_routing_delays(const system_index &index);
+
+    // Reads the speed of the socket enclosing each chosen unit
+    void build_execution_speeds(const system_index &index);
+
+    // Reads the optional b attribute (MB/s) of the <d> tags between 
+    // the chosen units. Unlike delays, bandwidths are not derived for 
+    // pairs without a <d> tag of their own
+    void build_bandwidths();
+
+    // The delay table is owned by this profile, so do not copy it
+    hwprofile(const hwprofile&);
+    hwprofile& operator=(const hwprofile&);
+
     public:
-      hwprofile(hwcom_type type, int compute_units, 
-        rapidxml::xml_document<char>* system);
-  
+      hwprofile(hwcom_type type, int compute_units,
+        rapidxml::xml_document<char>* system,
+        selection_strategy strategy = SELECT_FIRST);
+      ~hwprofile();
+
+      hwcom_type get_type() const { return type_; }
+      selection_strategy get_strategy() const { return strategy_; }
+
       // Given the 0...N-1 id, this will return the logical ID that
-      // is used in the system.xml file. 
+      // is used in the system.xml file.
       //
       // throws exception if id is outside 0...N-1
       int get_logical_id(int id);
-      
-      long get_routing_delay(int from, int to);
+
+      // Number of units (N) in this profile
+      int size() const { return ids_.size(); }
+
+      // Returns the profiled delay between two of the 0...N-1 ids.
+      // This is a plain table lookup with no bounds checking, as it
+      // is called from the inner loops of optimization algorithms
+      long get_routing_delay(int from, int to) const {
+        return delays_[from * ids_.size() + to];
+      }
+
+      // The full N*N row-major delay table
+      const long* get_routing_matrix() const { return delays_; }
+
+      // N execution speeds, where 1.0 is the fastest chosen unit, or
+      // NULL if no units were chosen
+      const double* get_execution_speeds() const {
+        return speeds_.empty() ? NULL : &speeds_[0];
+      }
+
+      // The full N*N row-major bandwidth table, in bytes per second, or
+      // NULL if no units were chosen
+      const double* get_bandwidth_matrix() const {
+        return bandwidths_.empty() ? NULL : &bandwidths_[0];
+      }
 
   };
+
+  // Byte alignment of the matrix returned by get_routing_matrix, 
+  // chosen to match a cache line
+  const int routing_matrix_alignment = 64;
   
   // Simple data storage class to allow a user to iteratively 
   // build a deployment
   class deployment {
     private: 
-      // First is task ID, second is hardware logical ID
-      // TODO why did I make this a vector and not just a map? 
-      std::vector<std::pair<int, int> > plan;
-      std::map<std::string, std::string> metrics;
+      // Logical ID each task is deployed onto, indexed by task ID, 
+      // or -1 if that task has not been deployed
+      std::vector<int> units_;
+      // Tasks in the order they were deployed, which is the order 
+      // they are written out in
+      std::vector<int> order_;
+
+      // Metrics keep their typed value, and are only turned into 
+      // text when the deployment is written out
+      struct metric {
+        enum kind { INTEGER, REAL, TEXT };
+        std::string name;
+        kind type;
+        long integer;
+        double real;
+        std::string text;
+      };
+      // The first metric_count_ entries are in use, sorted by name. 
+      // Entries past that are left over from before a clear(), and are
+      // reused so that their strings do not need to be reallocated
+      std::vector<metric> metrics_;
+      int metric_count_;
+
       rapidxml::xml_document<char>* system_;
       rapidxml::xml_document<char>* deployments_;
       hwprofile* profile;
+
+      // Returns the slot for the named metric, adding it if needed
+      metric& set_metric(const char* name);
+
+      // Writes the value of a metric as text into buf, returning buf
+      // or, for text metrics, the text itself
+      static const char* format(const metric &m, char* buf, int size);
       
       // Builds a 'safe' string for rapidxml
-      char* s(const char* unsafe);
-      char* s(int unsafe);
-      char* s(std::string unsafe);
+      char* s(const char* unsafe) const;
 
     public:
       deployment(hwprofile* prof, 
           rapidxml::xml_document<char>* system,
-          rapidxml::xml_document<char>* deployment);
+          rapidxml::xml_document<char>* deployment,
+          int tasks = 0);
       
       // Builds the xml to represent this deployment
-      node* get_xml();
+      node* get_xml() const;
+
+      // Appends the same XML that get_xml would build, as text, to out.
+      // Used when deployments are streamed directly to disk
+      void print(std::string &out, int id) const;
+
+      // Removes every task deployment and metric but keeps all of the
+      // memory, so that an algorithm can build one deployment per 
+      // iteration into the same object without allocating
+      void clear();
     
       // Add a deployment of a task to a hardware compute
       // unit, using the 0..N-1 id's from the hardware profile
-      // to describe hardware components
+      // to describe hardware components. Deploying a task a 
+      // second time moves it
       void add_task_deployment(int task, int hardware);
 
       // While an algorithm can add any metrics desired, there are 
@@ -192,19 +371,54 @@ namespace dove {
       // determine a cutoff point after which continued algorithm
       // iterations tend to yield a benefit that is below some 
       // threshold
-      void add_metric(std::string name, std::string value);
-      void add_metric(const char* name, std::string value);
+      //
+      // Adding a metric that already exists replaces its value. 
+      // Doubles are written in fixed notation with 19 decimals
+      void add_metric(const std::string &name, const std::string &value);
+      void add_metric(const char* name, const std::string &value);
       void add_metric(const char* name, const char* value);
       void add_metric(const char* name, int value);
-
-      // TODO override add_metric to support other types of 
-      // values
+      void add_metric(const char* name, long value);
+      void add_metric(const char* name, double value);
   };
 
-  void xlog(const char* msg, int level); 
-  void xdebug(const char* msg);
-  void info(const char* msg); 
-  void error(const char* msg);
+  // Logging levels. A message is printed if its level is at or below
+  // the runtime level, which starts at LOG_ALL, printing everything, 
+  // unless the DOVE_LOG_LEVEL environment variable is set (to a number
+  // or one of error, debug, info, all). Programs can also call 
+  // set_log_level, e.g. from a --loglevel flag.
+  //
+  // Messages above DOVE_MAX_LOG_LEVEL are removed at compile time, so
+  // building with e.g. -DDOVE_MAX_LOG_LEVEL=10 leaves only errors
+  const int LOG_ERROR =  10;
+  const int LOG_DEBUG =  30;
+  const int LOG_INFO  = 100;
+  const int LOG_ALL   = 999;
+
+  extern int log_level;
+
+  // Accepts a level name or number, throws if it is neither
+  int parse_log_level(const char* level);
+  void set_log_level(int level);
+  // Printed before every message, "dove" by default
+  void set_log_name(const char* name);
+
+  // True if a message at this level would be printed. Use this to 
+  // skip building a message that would not be shown
+  inline bool log_enabled(int level) {
+    return level <= DOVE_MAX_LOG_LEVEL && level <= log_level;
+  }
+
+  // Writes one message. Output is buffered, only errors are flushed
+  void write_log(const char* msg, int level);
+
+  inline void xlog(const char* msg, int level) { 
+    if (log_enabled(level)) 
+      write_log(msg, level);
+  }
+  inline void xdebug(const char* msg) { xlog(msg, LOG_DEBUG); }
+  inline void info(const char* msg) { xlog(msg, LOG_INFO); } 
+  inline void error(const char* msg) { xlog(msg, LOG_ERROR); }
 
   // Interfaces the DOVE validation suite with an optimization 
   // algorithm. An algorithm creates a deployment_optimization
@@ -218,6 +432,7 @@ namespace dove {
   // an XML file that can be read into the rest of the DOVE 
   // codebase to generate a real STG implementation and 
   // validate the optimization algorithm results
+  class deployment_queue;
   class validator {
 
     private:
@@ -245,6 +460,20 @@ namespace dove {
       // been called, so that we can append an ID to each deployment
       int number_deployments_;
 
+      // When streaming, deployments are printed into pending_ as they 
+      // are added instead of being kept in deployment_, and pending_ is
+      // written to stream_ every flush_interval_ deployments
+      std::ofstream* stream_;
+      std::string pending_;
+      int flush_interval_;
+      // File offset just past the last deployment written to stream_
+      long stream_end_;
+      void flush_pending();
+
+      // Deployments from submit_deployment wait here until the writer
+      // thread owned by the queue passes them to add_deployment
+      deployment_queue* queue_;
+
     public:
       validator(int tasks, 
         int compute_units,
@@ -252,7 +481,9 @@ namespace dove {
         const char* output_filename,
         const char* algorithm_name,
         const char* system_xml_path,
-        const char* algorithm_desc = "");
+        const char* algorithm_desc = "",
+        selection_strategy strategy = SELECT_FIRST);
+      ~validator();
 
       // TODO create constructor that accepts the 
       // <dove> directory, checks for system.xml, software.stg, 
@@ -281,7 +512,42 @@ namespace dove {
       // Dove allocates [0...compute_units] computation units 
       // when created. This function returns the real routing delay
       // from one unit to another
-      long get_routing_delay(int from, int to);
+      long get_routing_delay(int from, int to) const {
+        return profile->get_routing_delay(from, to);
+      }
+
+      // The number of compute units that dove allocated, N
+      int get_compute_units() const { return profile->size(); }
+
+      // Returns every routing delay between the compute units as one
+      // flat N*N row-major array, where entry [from * N + to] equals
+      // get_routing_delay(from, to). The array is aligned to 
+      // routing_matrix_alignment, is never written after the validator
+      // is created, and is owned by dove. It may be copied or viewed
+      // directly (including from multiple threads) until the validator
+      // is deleted
+      const long* get_routing_matrix() const {
+        return profile->get_routing_matrix();
+      }
+
+      // Returns N execution speeds, one per compute unit and in the 
+      // same order as the routing matrix rows. Speeds are relative to 
+      // the fastest unit (1.0), and are read from the speed attribute of
+      // the socket that holds each unit. If system.xml lists no speeds 
+      // every unit has speed 1.0
+      const double* get_execution_speeds() const {
+        return profile->get_execution_speeds();
+      }
+
+      // Returns the bandwidth in bytes per second between every pair of
+      // compute units, as one flat N*N array laid out like the routing
+      // matrix. Bandwidths come from the optional b attribute (MB/s) of
+      // the <d> tags in system.xml, which profile_latency writes when run
+      // with --bandwidth, and are 0 for pairs that have none, which 
+      // algorithms should treat as free of transfer cost
+      const double* get_bandwidth_matrix() const {
+        return profile->get_bandwidth_matrix();
+      }
 
       // An algorithm must inform dove of each deployment. This
       // function returns an empty deployment plan that the algorithm
@@ -299,10 +565,39 @@ namespace dove {
       // passed deployment, which is later used to automatically 
       // determine how many iterations should be run before the 
       // deployment will terminate
-      void add_deployment(deployment d);
+      void add_deployment(const deployment &d);
+
+      // Thread-safe version of add_deployment for algorithms that
+      // produce deployments from more than one thread. The deployment 
+      // is copied onto a queue, which is locked only for a few pointer
+      // moves, and this returns immediately; a single writer thread 
+      // started by the first submission assigns ids in the order 
+      // submissions arrive and does all XML and disk work. Deployments
+      // from one thread keep their relative order. Queue entries are 
+      // recycled, so after warm-up a submission only copies into memory
+      // that is already allocated.
+      //
+      // Single-threaded algorithms should call add_deployment directly.
+      //
+      // Do not mix with add_deployment, and make sure every producer 
+      // has finished before calling complete. Throws if called after
+      // complete
+      void submit_deployment(const deployment &d);
+
+      // Switches to streaming mode, in which deployments.xml is written
+      // while the algorithm runs and memory use does not grow with the
+      // number of deployments. Every flush_interval deployments the 
+      // pending deployments are written and the closing tags are 
+      // rewritten after them, so the file on disk is always complete 
+      // up to the last flush even if the algorithm crashes.
+      //
+      // Must be called before the first add_deployment. Throws if 
+      // the output file cannot be opened
+      void stream_deployments(int flush_interval = 100);
 
       // Informs dove that the algorithm has completed and all 
-      // data should be written to file
+      // data should be written to file. Waits for the writer thread
+      // to finish any submitted deployments
       void complete();
   };
 
@@ -13,66 +13,149 @@
 #include <boost/mpi/communicator.hpp>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <map>
+#include <limits.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 // Includes STG parser and default Makefile
 #include "main.h"
+#include "placements.h"
 #include "libs/rapidxml.hpp"
 #include "libs/rapidxml_utils.hpp"
 #include "libs/rapidxml_print.hpp"
 
 #include "libs/tclap/CmdLine.h"
 
+#include "dove.h"
+
 namespace mpi = boost::mpi;
 
+// The prebuilt runtime that the generated Makefile links impl to
+#ifndef STG_RUNTIME
+#define STG_RUNTIME "stg_runtime"
+#endif
+
 
 
 // Forward declare methods to come
 void run_simple_mpi(int argc, char* argv[]);
-void build_mpi_from_stl();
+void write_stg_data();
+void load_system();
 void build_rankfiles_from_deployment();
 void generate_hostfile();
 
 //
 // Outputs:
 //    output_directory/
-//    - input.cpp               (translated software model)
-//    - Makefile                (build input.cpp on ataack cloud)
-//    - rankfile.{0..N}         (one MPI rankfile for each deployment in optimization.xml)
+//    - stg.dag                 (software model read by the STG runtime)
+//    - Makefile                (links impl to the prebuilt STG runtime)
+//    - rankfile.{0..N}         (one MPI rankfile for each unique placement in optimization.xml)
+//    - tasks.{0..N}            (the tasks each rank of the rankfile runs, in order)
+//    - campaign.rankfile       (one rank per unit used by any placement)
+//    - campaign.txt            (how each placement maps onto campaign.rankfile)
+//    - placements.txt          (the rankfile number used by each deployment)
+//
+// Rankfiles are numbered 0..N-1 by placement, in the order each 
+// placement first appears in the deployments, not by <deployment id>. 
+// Only placements.txt ties the two together. With --nodedupe every
+// deployment gets its own number, which is its position in the file
 //    - run_mpi.sh              (sample run script)
 
 
 // Declare all of the variables that will be parsed by tclap for us
 static std::string stg_path;
+// Per-edge message sizes, see dove::read_edge_volumes
+static std::string edges_path;
 static std::string deployment_xml_path;
 static std::string system_xml_path;
 static std::string outdir;
 static bool debug_impl = false;
 static bool should_generate_hostfile = false;
 static bool should_run_make = true;
+// Number of threads that write rankfiles, 0 for one per hardware thread
+static unsigned int jobs = 0;
+// If true, deployments with the same placement share one rankfile
+static bool dedupe = true;
+// Unit of the STG execution times, one of s, ms, us or ns
+static std::string time_unit = "us";
+// If true, each host used gets one rank, running one pinned thread per
+// unit (the hybrid backend). Otherwise each unit used gets one rank
+static bool hybrid = false;
+
+// Type of hardware the deployments map tasks onto, read from the 
+// <mapping> of deployments.xml
+static dove::hwcom_type mapping_type = dove::CORE;
+
+// Every logical ID in system.xml, loaded once by load_system
+static dove::system_index* system_desc = NULL;
 
 static void parse_options(int argc, char *argv[]) {
   TCLAP::CmdLine cmd("Multi-core Deployment Optimization Model --> MPI Code Generator ", ' ', "0.1");
-  TCLAP::ValueArg<std::string> stg_arg("s", "stg", "path to STG file containing a directed acyclic graph describing the software model. Will result in a *.cpp file of the same unqualified name being generated and placed in the output directory", true, "", "STG path");
+  TCLAP::ValueArg<std::string> stg_arg("s", "stg", "path to STG file containing a directed acyclic graph describing the software model. Translated into stg.dag in the output directory", true, "", "STG path");
   cmd.add(stg_arg);
+  TCLAP::ValueArg<std::string> edges_arg("", "edges", "path to the per-edge message sizes of the STG, one '<from> <to> <bytes>' line per edge. Defaults to the STG path with an .edges extension. Edges without a size send empty messages", false, "", "edges path");
+  cmd.add(edges_arg);
   TCLAP::ValueArg<std::string> dep_arg("d", "deployments", "path to XML file containing all of the deployments", true, "", "Deployment XML");
   cmd.add(dep_arg);
   TCLAP::ValueArg<std::string> sys_arg("y", "system", "path to XML file containing a description of the final deployment system hardware. Used to understand the ID's of processing units used in the deployment XML file", true, "", "system XML");
   cmd.add(sys_arg);
-  TCLAP::ValueArg<std::string> dir_arg("o", "output", "path to a directory where output will be placed. Output directory should contain the stg_impl.cpp, Makefile, rankfile.{0..} (one for each deployment) and a sample run_mpi.sh showing how to phrase the running of all the MPI code. This directory should already exist, and the passed parameter should include the final backslash", true, "", "output dirpath");
+  TCLAP::ValueArg<std::string> dir_arg("o", "output", "path to a directory where output will be placed. Output directory will contain the stg.dag, Makefile, rankfile.{0..} (one for each deployment) and a sample run_mpi.sh showing how to phrase the running of all the MPI code. This directory should already exist, and the passed parameter should include the final backslash", true, "", "output dirpath");
   cmd.add(dir_arg);
-  TCLAP::SwitchArg debug_arg("", "debug", "Include println statements in the generated stg.cpp code (slows down MPI execution)", false);
+  TCLAP::SwitchArg debug_arg("", "debug", "Have the STG runtime print each message and computation (slows down MPI execution)", false);
   cmd.add(debug_arg);
   
   TCLAP::SwitchArg gen_hostfile("", "genhosts", "Automatically generate the hosts file from the system XML description");
   TCLAP::ValueArg<std::string> copy_hostfile("", "hostfile", "Hostfile to copy into the output directory", true, "hostfile", "filename");
   cmd.xorAdd(gen_hostfile, copy_hostfile);
 
-  TCLAP::SwitchArg should_make("r", "runmake", "Automatically try to build the stg_impl.cpp into an executable", true);
+  TCLAP::SwitchArg should_make("r", "runmake", "Automatically run the Makefile that links impl to the prebuilt STG runtime", true);
   cmd.add(should_make);
+
+  TCLAP::ValueArg<unsigned int> jobs_arg("j", "jobs", "Number of threads used to write rankfiles. Defaults to one per hardware thread", false, 0, "integer");
+  cmd.add(jobs_arg);
+
+  TCLAP::SwitchArg nodedupe_arg("", "nodedupe", "Write one rankfile for every deployment, even if several deployments place every task on the same hardware. Rankfiles are numbered by position in the deployments file, see placements.txt for their ids", false);
+  cmd.add(nodedupe_arg);
+ 
+  std::vector<std::string> units;
+  units.push_back("s");
+  units.push_back("ms");
+  units.push_back("us");
+  units.push_back("ns");
+  TCLAP::ValuesConstraint<std::string> unit_constraint(units);
+  TCLAP::ValueArg<std::string> unit_arg("", "timeunit", "Unit of the task execution times in the STG file. Defaults to us, which is what the optimizer assumes", false, "us", &unit_constraint);
+  cmd.add(unit_arg);
+ 
+  std::vector<std::string> backends;
+  backends.push_back("mpi");
+  backends.push_back("hybrid");
+  TCLAP::ValuesConstraint<std::string> backend_constraint(backends);
+  TCLAP::ValueArg<std::string> backend_arg("", "backend", "mpi runs one rank per unit used, and every edge between units is an MPI message. hybrid runs one rank per host used with a pinned thread per unit, so only edges between hosts are MPI messages and the rest are shared-memory flags. Defaults to mpi", false, "mpi", &backend_constraint);
+  cmd.add(backend_arg);
+  TCLAP::ValueArg<std::string> loglevel_arg("", "loglevel", "dove log level: error, debug, info, all or a number. Defaults to DOVE_LOG_LEVEL, or all", false, "", "level");
+  cmd.add(loglevel_arg);
  
   cmd.parse(argc, argv);
+  if (loglevel_arg.isSet()) {
+    try {
+      dove::set_log_level(dove::parse_log_level(loglevel_arg.getValue().c_str()));
+    } catch (const char* e) {
+      throw TCLAP::ArgException(e, "loglevel");
+    }
+  }
+  hybrid = backend_arg.getValue() == "hybrid";
+  time_unit = unit_arg.getValue();
+  jobs = jobs_arg.getValue();
+  dedupe = !nodedupe_arg.getValue();
   stg_path = stg_arg.getValue();
+  edges_path = edges_arg.isSet() ? edges_arg.getValue() : 
+    dove::get_edges_path(stg_path);
   deployment_xml_path = dep_arg.getValue();
   system_xml_path = sys_arg.getValue();
   outdir = dir_arg.getValue();
@@ -99,18 +182,18 @@ int main(int argc, char* argv[])
     exit(EXIT_SUCCESS);
   }
  
+  load_system();
+  // Rankfiles first, as they read the mapping type the hostfile needs
+  build_rankfiles_from_deployment();
   if (should_generate_hostfile)
     generate_hostfile();
- 
-  // TODO verify that deployment only uses IDs from the mapping it
-  // claims
-  build_rankfiles_from_deployment();
-  build_mpi_from_stl();
+  write_stg_data();
   
   // Write out the default Makefile  
   std::string dest = outdir;
   dest.append("Makefile");
   std::ofstream  dst(dest.c_str());
+  dst << "STG_RUNTIME ?= " << STG_RUNTIME << "\n";
   dst << default_makefile;
   dst.close();
 
@@ -120,7 +203,7 @@ int main(int argc, char* argv[])
   std::ofstream  rmdst(dest.c_str());
   rmdst << default_run;
   
-  // Run makefile to build impl from stg_impl.cpp 
+  // Run makefile to link impl to the STG runtime
   if (should_run_make) {
     std::string make = "make -C ";
     make.append(outdir);
@@ -132,107 +215,79 @@ int main(int argc, char* argv[])
   return 0;
 }
 
-void generate_hostfile() {
+void load_system() {
   rapidxml::file<> xml_system(system_xml_path.c_str());
   rapidxml::xml_document<> sys_doc;
   sys_doc.parse<0>(xml_system.data());
-  
+  // The index copies what it needs, so the document can go away
+  system_desc = new dove::system_index(sys_doc);
+}
+
+void generate_hostfile() {
   std::string dest = outdir;
   dest.append("hostfile.txt");
   std::ofstream  hosts(dest.c_str());
 
-  rapidxml::xml_node<>* nodes = sys_doc.first_node("system")->first_node("nodes");
-  for (rapidxml::xml_node<> *node = nodes->first_node(); 
-       node; 
-       node = node->next_sibling()) {
-    std::string ip = node->first_attribute("ip")->value();
-    int slotcount = 0;
-    for (rapidxml::xml_node<> *proc = node->first_node(); proc; 
-         proc = proc->next_sibling()) 
-      slotcount++;
-    
-    hosts << ip << " slots=" << slotcount << std::endl;
-  } 
+  // Each host gets one slot per unit of the mapped type it contains
+  std::map<int, int> slots;
+  const std::vector<int> &units = system_desc->get_ids(mapping_type);
+  for (int u = 0; u < units.size(); u++)
+    slots[system_desc->get(units[u]).node_id]++;
+
+  const std::vector<int> &nodes = system_desc->get_ids(dove::HOST);
+  for (int n = 0; n < nodes.size(); n++)
+    hosts << system_desc->get(nodes[n]).ip << " slots=" << slots[nodes[n]] << std::endl;
 }
 
-// http://stackoverflow.com/questions/5465227
-rapidxml::xml_node<>* get_child_with_id(rapidxml::xml_node<> *inputNode, std::string id)
-{
-  // cycles every child
-  for (rapidxml::xml_node<> *nodeChild = inputNode->first_node(); nodeChild; nodeChild = nodeChild->next_sibling())
-  {
-    if (strcmp(nodeChild->first_attribute("id")->value(), id.c_str()) == 0)
-  return nodeChild;
-    
-    rapidxml::xml_node<>* x = get_child_with_id(nodeChild, id);
-    if (x) 
-      return x;
-  }
-  return 0;
+// Writes text to path with a single write. Returns false on failure
+static bool write_file(const std::string &path, const std::string &text) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0 && 
+    write(fd, text.data(), text.size()) == (ssize_t) text.size();
+  if (fd >= 0)
+    close(fd);
+  return ok;
 }
 
-// Given a single logical ID, this function searches through the XML until
-// that logical ID is located and outputs the physical ID values for node,
-// processor, core, and hardware thread that match that logical ID. For
-// many inputs the output will be blank e.g. passing in the logical ID
-// of a processor will result in only outputs for the physical ID of the
-// node and the processor
-void parse_ids_from_system_xml(std::string logical_id,
-        int &node_pid, 
-        int &proc_pid, 
-        int &core_pid, 
-        int &hwth_pid, 
-        std::string &hostname, 
-        std::string &ip) {
-  
-  // Using this over rapidxml::file because that approach destroys
-  // the original file for some reason. This is known to be a slow
-  // way to read in a file, so in the future it should be updated
-  /*std::ifstream t(system_xml_path.c_str());
-  std::stringstream buffer;
-  buffer << t.rdbuf();
-  t.close();
-  char *cstr = new char[buffer.str().length() + 1];
-  strcpy(cstr, buffer.str().c_str());
-  */
-
-  rapidxml::file<> sys_xml(system_xml_path.c_str());
-  rapidxml::xml_document<> sys_doc;
-  sys_doc.parse<0>(sys_xml.data());
-  
-  rapidxml::xml_node<>* nodes = sys_doc.first_node("system")->
-  first_node("nodes");
-  rapidxml::xml_node<>* node = get_child_with_id(nodes, logical_id);
-  
-  // While we have not returned to the root
-  while (strcmp(node->name(), "nodes") != 0) {
-    std::string name = node->name();
-    int pindex = atoi( node->first_attribute("pindex")->value() );
-    if (name.compare("pu") == 0)
-      hwth_pid = pindex;
-    else if (name.compare("core") == 0)
-      core_pid = pindex;
-    else if (name.compare("socket") == 0) 
-      proc_pid = pindex;
-    else if (name.compare("node") == 0) {
-      node_pid = pindex;
-      ip = node->first_attribute("ip")->value();
-      hostname = node->first_attribute("hostname")->value();
+// Writes campaign.rankfile, with one rank for every unit (or host, for
+// the hybrid backend) that any placement uses, and campaign.txt, which
+// tells the runtime how each placement's ranks map onto those ranks. 
+// Together they let every placement run in one mpirun launch
+static void write_campaign(size_t placement_count, 
+    const std::vector<std::vector<int> > &rank_units,
+    const std::vector<std::string> &suffix) {
+  std::map<int, int> unit_of_key;
+  for (size_t p = 0; p < placement_count; p++)
+    for (size_t r = 0; r < rank_units[p].size(); r++) {
+      int unit = rank_units[p][r];
+      unit_of_key[hybrid ? system_desc->get(unit).node_id : unit] = unit;
     }
-    else
-      throw "Unknown tag in XML. Valid values underneath 'nodes' are node,socket,core,pu";
-    
-    node = node->parent();
-  }   
 
- // delete [] cstr;
-}
+  std::string rankfile_text;
+  std::map<int, int> rank_of_key;
+  for (std::map<int, int>::iterator it = unit_of_key.begin(); 
+       it != unit_of_key.end(); it++) {
+    int rank = rank_of_key.size();
+    std::ostringstream line;
+    line << "rank " << rank << suffix[it->second];
+    rank_of_key[it->first] = rank;
+    rankfile_text += line.str();
+  }
+
+  std::ostringstream campaign;
+  campaign << "dove-campaign 1\nranks " << rank_of_key.size() << "\n";
+  for (size_t p = 0; p < placement_count; p++) {
+    campaign << p << " tasks." << p << " " << rank_units[p].size();
+    for (size_t r = 0; r < rank_units[p].size(); r++) {
+      int unit = rank_units[p][r];
+      campaign << " " << rank_of_key[hybrid ? system_desc->get(unit).node_id : unit];
+    }
+    campaign << "\n";
+  }
 
-void write_rank_core(std::ofstream& out, int rank, std::string host, int procpid, int corepid) {
-  // Cores are "rank %s=%s slot=p%d:%d\n" 
-  // rank 1=10.0.2.4 slot=p1:8
-  // references physical socket 1 and physical core 8
-  out << "rank " << rank << "=" << host << " slot=p" << procpid << ":" << corepid << std::endl;
+  if (!write_file(outdir + "campaign.rankfile", rankfile_text) ||
+      !write_file(outdir + "campaign.txt", campaign.str()))
+    throw "Unable to write the campaign into the output directory";
 }
 
 void build_rankfiles_from_deployment() {
@@ -242,217 +297,210 @@ void build_rankfiles_from_deployment() {
   rapidxml::file<> xml_deployment(deployment_xml_path.c_str());
   dep_doc.parse<0>(xml_deployment.data());
   
-  // Pull out the mapping we are using and translate
-  // that into a proper rankfile format
-  //std::string mapping = dep_doc.first_node("optimization")->
-  //first_node("mapping")->first_attribute("to")->value();
-  void (*write_rank_line) (std::ofstream&, int, std::string, int, int);
-
-  // TODO support other mappings
-  //if (mapping.compare("cores") == 0) 
-    write_rank_line = &write_rank_core;
-  /*else if (mapping.compare("nodes") == 0){
-    throw "only cores supported now";
-  } else if (mapping.compare("hw-threads") == 0) {
-    throw "only cores supported now";
-  } else if (mapping.compare("processors") == 0) {
-    throw "only cores supported now";
-  } else
-    throw "The provided mapping was not recognized. Use one of cores,nodes,processors,hw-threads";
-  */
+  // Pull out the mapping we are using. Deployments written before 
+  // the mapping was recorded are always onto cores
+  rapidxml::xml_node<>* mapping_node = dep_doc.first_node("optimization")->
+    first_node("mapping");
+  if (mapping_node != 0)
+    mapping_type = dove::parse_type_name(
+        mapping_node->first_attribute("to")->value());
+
+  // Everything after "rank N" for each logical ID of the mapped type, 
+  // e.g. "=10.0.2.4 slot=p1:8\n", indexed by logical ID. IDs that are 
+  // not of the mapped type are left empty
+  const std::vector<int> &units = system_desc->get_ids(mapping_type);
+  int max_id = units.empty() ? -1 : *std::max_element(units.begin(), units.end());
+  std::vector<std::string> suffix(max_id + 1);
+  // For the hybrid backend, the rankfile suffix of the host holding 
+  // each unit, and the OS CPUs a unit's thread is pinned to
+  std::vector<std::string> host_suffix(max_id + 1);
+  std::vector<int> host_of(max_id + 1, -1);
+  std::vector<std::string> cpus(max_id + 1);
+  for (int u = 0; u < units.size(); u++) {
+    const dove::hwcom &com = system_desc->get(units[u]);
+    suffix[units[u]] = "=" + com.hostname + " slot=" + com.slot + "\n";
+    const dove::hwcom &host = system_desc->get(com.node_id);
+    host_suffix[units[u]] = "=" + host.hostname + " slot=" + host.slot + "\n";
+    host_of[units[u]] = com.node_id;
+    cpus[units[u]] = com.cpus.empty() ? "-" : com.cpus;
+  }
+  if (hybrid)
+    suffix.swap(host_suffix);
+
+  size_t longest_suffix = 0;
+  for (int i = 0; i <= max_id; i++)
+    longest_suffix = std::max(longest_suffix, suffix[i].size());
 
   // Locate all deployments
   rapidxml::xml_node<>* deps = dep_doc.first_node("optimization")->
   first_node("deployments");
-  int deployment_id = 0;
+  std::vector<rapidxml::xml_node<>*> deployments;
   for (rapidxml::xml_node<>* deployment = deps->first_node();
        deployment;
-       deployment = deployment->next_sibling()) {
-    
-    // Start writing the rankfile
-    std::string id = deployment->first_attribute("id")->value();
-    std::string rankfile = outdir;
-    rankfile.append("rankfile.").append(id.c_str());
-    std::ofstream rf;
-    rf.open(rankfile.c_str());
-
-    deployment_id++;
-    
-    // Iterate over every mapping in deployment
-    for (rapidxml::xml_node<>* mapping = deployment->first_node();
+       deployment = deployment->next_sibling())
+    deployments.push_back(deployment);
+
+  // Each used unit gets one rank, which runs the tasks placed on it in
+  // the order the deployment lists them (the order the optimizer 
+  // scheduled them in). A placement is therefore the list of (unit, 
+  // task) pairs sorted by unit, keeping the deployment's order within
+  // each unit. Optimizers often emit the same placement many times, so
+  // each unique placement gets one rankfile. placement_of[d] is the 
+  // placement deployment d uses
+  std::vector<size_t> placement_of(deployments.size());
+  placement_set placements(dedupe);
+  placement_plan plan;
+  for (size_t d = 0; d < deployments.size(); d++) {
+    plan.clear();
+    for (rapidxml::xml_node<>* mapping = deployments[d]->first_node("deploy");
          mapping;
-         mapping = mapping->next_sibling()) {
-     
-      // Skip anything that's not a 'deploy' tag
-      if (strcmp(mapping->name(), "deploy") != 0)
-        continue;
-
-      int rank = atoi( mapping->first_attribute("t")->value() );
-      std::string logical_id = mapping->first_attribute("u")->value();
-      
-      std::string hostname;
-      std::string ip;
-      int node_pid;
-      int proc_pid;
-      int core_pid;
-      int hwth_pid;
-      parse_ids_from_system_xml(logical_id, 
-          node_pid, 
-          proc_pid, 
-          core_pid, 
-          hwth_pid, 
-          hostname, 
-          ip);
-      
-      // Then write them to the file
-      write_rank_line(rf, rank, hostname, proc_pid, core_pid);
-
-    } // Done with mappings for one deployment
+         mapping = mapping->next_sibling("deploy"))
+      plan.push_back(std::make_pair(
+            atoi( mapping->first_attribute("u")->value() ),
+            atoi( mapping->first_attribute("t")->value() )));
+    std::stable_sort(plan.begin(), plan.end(), 
+        [](const std::pair<int, int> &a, const std::pair<int, int> &b) {
+          return a.first < b.first;
+        });
+    placement_of[d] = placements.add(plan);
+  }
+  std::cout << "Writing " << placements.size() << " rankfiles for " << 
+    deployments.size() << " deployments" << std::endl;
+
+  // Workers take the next placement off a shared counter until there
+  // are none left. The placements and the suffix table are only read
+  std::atomic<size_t> next_placement(0);
+  // The first unit of every rank of each placement, for the campaign
+  std::vector<std::vector<int> > rank_units(placements.size());
+  std::atomic<bool> bad_id(false);
+  std::atomic<bool> bad_write(false);
+  unsigned int workers = jobs != 0 ? jobs : std::thread::hardware_concurrency();
+  if (workers == 0)
+    workers = 1;
+  workers = std::min<size_t>(workers, std::max<size_t>(placements.size(), 1));
+
+  std::vector<std::thread> pool;
+  for (unsigned int w = 0; w < workers; w++)
+    pool.push_back(std::thread([&]() {
+      // Each file is formatted here and written with one write
+      std::string rankfile_text;
+      std::string tasks_text;
+      char number[32];
+      for (size_t p = next_placement++; p < placements.size(); 
+           p = next_placement++) {
+        const placement_plan &placed = placements[p];
+        rankfile_text.clear();
+        rankfile_text.reserve(placed.size() * (sizeof(number) + longest_suffix));
+        tasks_text.clear();
+    
+        // One worker per run of pairs on the same unit. Each worker 
+        // is its own rank, or with the hybrid backend a thread of its
+        // host's rank
+        std::vector<int> rank_hosts;
+        for (size_t first = 0; first < placed.size(); ) {
+          int logical_id = placed[first].first;
+          if (logical_id < 0 || logical_id > max_id || suffix[logical_id].empty()) {
+            bad_id = true;
+            return;
+          }
+          size_t last = first;
+          while (last < placed.size() && placed[last].first == logical_id)
+            last++;
+
+          int key = hybrid ? host_of[logical_id] : logical_id;
+          int rank = std::find(rank_hosts.begin(), rank_hosts.end(), key) - 
+            rank_hosts.begin();
+          if (rank == rank_hosts.size()) {
+            rank_hosts.push_back(key);
+            int length = snprintf(number, sizeof(number), "rank %d", rank);
+            rankfile_text.append(number, length);
+            rankfile_text += suffix[logical_id];
+            rank_units[p].push_back(logical_id);
+          }
+
+          int length = snprintf(number, sizeof(number), "%d ", rank);
+          tasks_text.append(number, length);
+          tasks_text += hybrid ? cpus[logical_id] : "-";
+          length = snprintf(number, sizeof(number), " %zu", last - first);
+          tasks_text.append(number, length);
+          for (; first < last; first++) {
+            length = snprintf(number, sizeof(number), " %d", placed[first].second);
+            tasks_text.append(number, length);
+          }
+          tasks_text += "\n";
+        }
        
-    rf.close();
-  } // Done with all deployments
-  
-
+        char placement_id[32];
+        snprintf(placement_id, sizeof(placement_id), "%zu", p);
+        std::string rankfile = outdir;
+        rankfile.append("rankfile.").append(placement_id);
+        std::string tasks = outdir;
+        tasks.append("tasks.").append(placement_id);
+        if (!write_file(rankfile, rankfile_text) || 
+            !write_file(tasks, tasks_text))
+          bad_write = true;
+      }
+    }));
+  for (unsigned int w = 0; w < pool.size(); w++)
+    pool[w].join();
+
+  if (bad_id)
+    throw "A deployment uses a logical ID that is not the type of its mapping";
+  if (bad_write)
+    throw "Unable to write a rankfile into the output directory";
+
+  write_campaign(placements.size(), rank_units, suffix);
+
+  // Tells the runner which rankfile and tasks file each deployment 
+  // uses. One line per deployment: <deployment id> <placement id>
+  std::string index = outdir;
+  index.append("placements.txt");
+  std::ofstream placements_out(index.c_str());
+  for (size_t d = 0; d < deployments.size(); d++)
+    placements_out << deployments[d]->first_attribute("id")->value() << " " 
+      << placement_of[d] << "\n";
+  placements_out.close();
+  if (!placements_out)
+    throw "Unable to write placements.txt into the output directory";
 }
 
-void build_mpi_case_for_task(unsigned int tid, unsigned int exectime, std::vector<unsigned int>& pre, std::vector<unsigned int>& post, std::ofstream& out);
-void build_mpi_from_stl() {
+// Writes the STG as a stg.dag file for the prebuilt runtime, which 
+// reads it at startup (see runtime/main.cpp for the format)
+void write_stg_data() {
   DirectedAcyclicGraph* task_precedence = NULL;
   std::vector<Task>* tasks = parse_stg(stg_path.c_str(), task_precedence);
   
+  std::map<std::pair<unsigned int, unsigned int>, unsigned long long> bytes;
+  std::vector<std::vector<unsigned int> > successors(tasks->size());
+  for (int t = 0; t < tasks->size(); t++)
+    successors[t] = task_precedence->get_successors(t);
+  std::vector<dove::edge_volume> volumes = 
+    dove::read_edge_volumes(edges_path.c_str(), successors);
+  for (int e = 0; e < volumes.size(); e++) {
+    if (volumes[e].bytes > INT_MAX)
+      throw "Edge volumes must fit in one MPI message (under 2GB)";
+    bytes[std::make_pair(volumes[e].from, volumes[e].to)] = volumes[e].bytes;
+  }
+  
   std::string dest = outdir;
-  dest.append("stg_impl.cpp");
+  dest.append("stg.dag");
   std::ofstream  out(dest.c_str());
 
-  // Write header
-  const char * header =
-    "#include <boost/mpi.hpp>\n"
-    "#include <boost/mpi/collectives.hpp>\n"
-    "#include <boost/mpi/environment.hpp>\n"
-    "#include <boost/mpi/communicator.hpp>\n"
-    "#include <time.h>\n"
-    "namespace mpi = boost::mpi;\n\n"
-    "timespec diff(timespec start, timespec end)\n"
-    "{  timespec temp;\n"
-    "   if ((end.tv_nsec-start.tv_nsec)<0) {\n"
-    "     temp.tv_sec = end.tv_sec-start.tv_sec-1;\n"
-    "     temp.tv_nsec = 1000000000+end.tv_nsec-start.tv_nsec;\n"
-    "   } else {\n"
-    "     temp.tv_sec = end.tv_sec-start.tv_sec;\n"
-    "     temp.tv_nsec = end.tv_nsec-start.tv_nsec;\n"
-    "     }\n"
-    "  return temp;}\n\n";
-  out << header;
-
-  const char * start_main =
-    "int main(int argc, char* argv[]) {\n"
-    "  mpi::environment env(argc, argv);\n"
-    "  mpi::communicator world;\n";
-  out << start_main;
-  
-  // Switch start
-  out <<
-    "  switch (world.rank()) {\n";
-  
-  // build case (task_id, task_predecessors, task_sucessors, task_execution_time, out)
+  out << "dove-stg 2\n";
+  out << "tasks " << tasks->size() << " debug " << (debug_impl ? 1 : 0) << 
+    " unit " << time_unit << "\n";
   for (int i = 0; i < tasks->size(); i++) {
     Task task = tasks->at(i);
     std::vector<unsigned int> pre = task_precedence->get_predecessors(task.int_identifier_);
     std::vector<unsigned int> post = task_precedence->get_successors(task.int_identifier_);
-    build_mpi_case_for_task(task.int_identifier_, task.execution_time_, pre, post, out);
-  }
-  
-  // Switch End
-  out <<
-    "  }\n"
-    "  return 0;\n"
-    "}\n\n";
-
-}
-
-void build_mpi_case_for_task(unsigned int tid, unsigned int exectime, std::vector<unsigned int>& pre, std::vector<unsigned int>& post, std::ofstream& out) {
-  
-  // ========= Case Header
-  out <<
-    "    case " << tid << ": {\n";
-  if (debug_impl)
-    out <<
-      "      std::cout << \"" << tid << ": Awake\" << std::endl;\n";
-
-  // ========= Receive Predecessors
-  if (pre.size() != 0) {
-    out <<
-      "      mpi::request req[" << pre.size() << "];\n";
+    out << task.int_identifier_ << " " << task.execution_time_ << " " << pre.size();
     for (int p = 0; p < pre.size(); p++)
-      out <<
-        "      req[" << p << "] = world.irecv(" << pre[p] << ", 0);\n";
-    out <<
-      "      mpi::wait_all(req, req + " << pre.size() << ");\n";
-
-    if (debug_impl)
-      for (int p = 0; p < pre.size(); p++)
-        out <<
-          "      std::cout << \"" << tid << ": Recv notice from pred " << pre[p] << "\" << std::endl;\n";
-  }
-
-
-  // ========= Perform Computation
-  out <<
-    "      timespec start, end;\n"
-    "      clock_gettime(CLOCK_MONOTONIC, &start);\n";
-  
-  if (debug_impl)
-    out <<
-    "      std::cout << \"" << tid << ": Started compute\" << std::endl;\n";
-  out <<
-   "      do clock_gettime(CLOCK_MONOTONIC, &end);\n"
-   "      while (diff(start, end).tv_nsec < " << (exectime*1000000) << ");\n";
-  if (debug_impl)
-    out <<
-    "      std::cout << \"" << tid << ": Finished compute in \" << diff(start, end).tv_sec << \"s,\" << \n"
-    "        diff(start, end).tv_nsec << std::endl;\n";
-  // TODO see below comment for more, but the above code is interpreting all 
-  // execution times from the STG as though they were in microseconds
-
-  // TODO dynamically choose (or be instructed) the metric prefix needed
-  // for number of seconds of computation. If routing between cores (which are 
-  // 0-2 microseconds on one of our machines) then you probably want computation
-  // to be in microseconds so that routing delay has some effect on overall 
-  // time. However, this value has to agree with whatever interpretation the 
-  // optimization algorithm is using. We cannot have the 'computation delay'
-  // here be in mircoseconds, but the optimization algorihtm is expecting that
-  // both computation and routing delays are in seconds. 
-  //
-  // TODO update the above so that instead of running in seconds it runs
-  // in microseconds
-  // clock_gettime(CLOCK_REALTIME, &ts);
-  // If time is more than one second
-  //  do clock_gettime(CLOCK_MONOTONIC, &end);
-  //    while (diff(start, end).tv_sec < 2);
-  // If time is less than one second
-  //    while (diff(start, end).tv_nsec < 500000);
-  
-  // ========= Send to Successors
-  if (post.size() != 0) {
-    out <<
-    "      mpi::request sreq[" << post.size() << "];\n";
+      out << " " << pre[p] << " " << 
+        bytes[std::make_pair(pre[p], (unsigned int) task.int_identifier_)];
+    out << " " << post.size();
     for (int p = 0; p < post.size(); p++)
-      out <<
-      "      sreq[" << p << "] = world.isend(" << post[p] << ", 0);\n";
-    out <<
-    "      mpi::wait_all(sreq, sreq + " << post.size() << ");\n";
-    
-    if (debug_impl)
-      for (int p = 0; p < post.size(); p++)
-        out <<
-        "      std::cout << \"" << tid << ": Sent notice to succ " << post[p] << "\" << std::endl;\n";
-  } else
-    if (debug_impl)
-      out <<
-        "      std::cout << \"" << tid << ": DONE!!\" << std::endl;\n";
-
-  // ========= Case Footer
-  out <<
-    "      break; }\n";
+      out << " " << post[p] << " " << 
+        bytes[std::make_pair((unsigned int) task.int_identifier_, post[p])];
+    out << "\n";
+  }
 }
-
@@ -9,25 +9,24 @@
 #ifndef DeploymentOptimization_main_h
 #define DeploymentOptimization_main_h
 
+// The STG is not compiled, impl is the prebuilt runtime reading 
+// stg.dag. STG_RUNTIME is written above this by the generator
 const char *default_makefile = ""
-"CFLAGS= -O3 -I/usr/include/openmpi-x86_64\n"
-"LD_LIBRARY_PATH=/usr/local/lib:/usr/lib64/openmpi/lib\n"
-"LDFLAGS=-L/usr/local/lib -L/usr/lib64/openmpi/lib\n"
-"LIBS = $(LDFLAGS) -lmpi -lmpi_cxx -lboost_serialization -lboost_mpi -lrt \n"
 "\n"
 "all:\n"
-"\tg++ $(CFLAGS) $(LIBS) stg_impl.cpp -o impl\n"
+"\tln -sf $(STG_RUNTIME) impl\n"
 "\n"
 "clean:\n"
 "\trm -f impl\n\n";
 
 const char* default_run = ""
 "#!/bin/sh\n"
-"RANKS=$(wc -l rankfile.0 | cut --delimiter=\\  -f 1)\n"
 "for file in $(ls | grep -e \"rankfile.[0-9]*$\")\n"
 "do\n" 
 "  echo \"Running $file\"\n"
-"  PROC_TIME=$(time (mpirun --rankfile $file --hostfile hostfile.txt -np $RANKS impl >/dev/null 2>&1) 2>&1)\n"
+"  RANKS=$(wc -l < $file)\n"
+"  TASKS=tasks.${file#rankfile.}\n"
+"  PROC_TIME=$(time (mpirun --rankfile $file --hostfile hostfile.txt -np $RANKS impl --tasks $TASKS >/dev/null 2>&1) 2>&1)\n"
 "  echo \"Took $PROC_TIME\"\n"
 "  echo $PROC_TIME > $file.time\n"
 "done\n";
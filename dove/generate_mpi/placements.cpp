@@ -0,0 +1,23 @@
+#include "placements.h"
+
+uint64_t hash_placement(const placement_plan &plan) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < plan.size(); i++) {
+    hash = (hash ^ (uint32_t) plan[i].first) * 1099511628211ULL;
+    hash = (hash ^ (uint32_t) plan[i].second) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+size_t placement_set::add(const placement_plan &plan) {
+  size_t id = placements_.size();
+  if (dedupe_) {
+    std::vector<size_t> &same_hash = by_hash_[hash_placement(plan)];
+    for (size_t i = 0; i < same_hash.size(); i++)
+      if (placements_[same_hash[i]] == plan)
+        return same_hash[i];
+    same_hash.push_back(id);
+  }
+  placements_.push_back(plan);
+  return id;
+}
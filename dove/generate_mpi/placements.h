@@ -0,0 +1,38 @@
+#ifndef __PLACEMENTS_H_INCLUDED__
+#define __PLACEMENTS_H_INCLUDED__
+
+#include <cstddef>
+#include <stdint.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A placement is the list of (unit, task) pairs of a deployment, sorted
+// by unit and keeping the deployment's order within each unit
+typedef std::vector<std::pair<int, int> > placement_plan;
+
+// FNV-1a over the pairs of a placement
+uint64_t hash_placement(const placement_plan &plan);
+
+// The placements the generator writes rankfiles for, in the order they
+// were first added. With dedupe, a placement equal to one added before
+// is not added again
+class placement_set {
+  bool dedupe_;
+  std::vector<placement_plan> placements_;
+  std::unordered_map<uint64_t, std::vector<size_t> > by_hash_;
+
+  public:
+    placement_set(bool dedupe) : dedupe_(dedupe) {}
+
+    // Returns the id of the placement, which is new unless dedupe 
+    // found an equal one
+    size_t add(const placement_plan &plan);
+
+    size_t size() const { return placements_.size(); }
+    const placement_plan& operator[](size_t id) const { 
+      return placements_[id]; 
+    }
+};
+
+#endif
@@ -0,0 +1,973 @@
+//
+//  runtime/main.cpp
+//  DeploymentOptimization
+//
+//  Runs the STG described by a stg.dag file from the generator. The 
+//  tasks file names the workers of each MPI rank and the tasks each 
+//  worker runs, one after another in the order listed, which is the 
+//  order the optimizer scheduled them in. A rank with one worker runs 
+//  it on the main thread; a rank with several (the hybrid backend, one
+//  rank per host) runs each on its own thread, pinned to the worker's 
+//  CPUs. A task waits for every predecessor, computes for its execution
+//  time, and then signals every successor:
+//    - on the same worker, the predecessor has already run
+//    - on another worker of the same rank, through an atomic flag that
+//      the waiter spins on briefly and then sleeps on with a futex
+//    - on another rank, with an MPI message tagged with the ID of its 
+//      edge and carrying as many bytes as the edge has in stg.dag
+//  Every receive is posted into its own buffer before the first task 
+//  runs. Because the graph is read at startup, one build of this 
+//  program runs every STG.
+//
+//  Computation spins on the cycle counter, which is calibrated against
+//  the monotonic clock once per host at startup. Durations from 1ns to
+//  many seconds are honoured in the unit given by stg.dag.
+//
+//  Usage: impl [--tasks <file>] [--trace <file>] [path to stg.dag]
+//         impl --campaign <file> [--runs <n>] [--results <file>] 
+//              [path to stg.dag]
+//  Without a path, stg.dag is read from the directory holding the 
+//  executable (or the impl symlink to it). Without a tasks file, rank 
+//  N runs task N. Rank 0 prints a "dove-makespan <ns>" line: the time 
+//  from a barrier after startup until the last rank finished its last
+//  send. It then prints a "dove-counters [<name> <count>]..." line with
+//  the cycles, instructions, LLC misses, context switches and CPU 
+//  migrations of that time, summed over every rank, for each counter 
+//  perf_event gives every rank. With --trace, the times at which each 
+//  task woke, started computing, finished computing and finished 
+//  sending are gathered to rank 0 and written to file.
+//
+//  A campaign runs every placement of a campaign file n times (or as
+//  many times as the file gives it) in one launch, over ranks that cover every unit any placement uses, so 
+//  that mpirun and MPI_Init are paid for once. Rank 0 writes one 
+//  "<placement id> <run> <ns>" line per run to the results file (or 
+//  stdout), timed the same way as dove-makespan. Campaigns are not 
+//  traced and report no counters
+//
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <memory>
+
+// One task of the STG
+struct task {
+  int id;
+  unsigned long long exectime;
+  std::vector<int> pred;
+  std::vector<int> succ;
+  // Message size in bytes of each edge in pred and succ
+  std::vector<int> pred_bytes;
+  std::vector<int> succ_bytes;
+  // ID of each edge in pred and succ, used as its message tag
+  std::vector<int> pred_edge;
+  std::vector<int> succ_edge;
+};
+
+// A thread of one rank, and the tasks it runs in order
+struct worker {
+  int rank;
+  // OS CPU indices to pin the thread to, or none to leave it where 
+  // mpirun bound the rank
+  std::vector<int> cpus;
+  std::vector<int> tasks;
+};
+
+// The workers of every rank for one placement of the tasks, with the
+// rank and worker index of every task
+struct layout {
+  std::vector<worker> workers;
+  std::vector<int> rank_of;
+  std::vector<int> worker_of;
+};
+
+// When one task passed each point, in ns on rank 0's clock since the
+// ranks were synchronised
+struct trace_record {
+  int64_t task;
+  int64_t rank;
+  int64_t wake;
+  int64_t start;
+  int64_t compute_end;
+  int64_t send_end;
+};
+
+static uint64_t monotonic_ns() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// The cycle counter the compute loop spins on. Off x86 there is no 
+// cheap counter and the monotonic clock is used, at one tick per ns
+static inline uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return monotonic_ns();
+#endif
+}
+
+// Measures cycle counter ticks per nanosecond against the monotonic 
+// clock. Only one rank on each host calibrates, and shares the result
+// with the others over host, so every task on a host spins the same
+static double calibrate_cycles(MPI_Comm host) {
+  int host_rank;
+  MPI_Comm_rank(host, &host_rank);
+  double ticks_per_ns = 1.0;
+  if (host_rank == 0) {
+    uint64_t start_ns = monotonic_ns(), start = read_cycles();
+    uint64_t end_ns;
+    do end_ns = monotonic_ns();
+    while (end_ns - start_ns < 20000000ULL);
+    ticks_per_ns = (double) (read_cycles() - start) / (end_ns - start_ns);
+  }
+  MPI_Bcast(&ticks_per_ns, 1, MPI_DOUBLE, 0, host);
+  return ticks_per_ns;
+}
+
+// Busy-waits for ticks of the cycle counter
+static void compute(uint64_t ticks) {
+  uint64_t start = read_cycles();
+  while (read_cycles() - start < ticks)
+    ;
+}
+
+// Nanoseconds in one unit of STG execution time, or 0 if unknown
+static uint64_t unit_ns(const char* unit) {
+  if (strcmp(unit, "s") == 0)
+    return 1000000000ULL;
+  if (strcmp(unit, "ms") == 0)
+    return 1000000ULL;
+  if (strcmp(unit, "us") == 0)
+    return 1000ULL;
+  if (strcmp(unit, "ns") == 0)
+    return 1ULL;
+  return 0;
+}
+
+// Reads a count and then that many "<task> <bytes>" edges
+static bool read_edges(FILE* dag, std::vector<int> &ids, 
+    std::vector<int> &bytes) {
+  int count;
+  if (fscanf(dag, "%d", &count) != 1 || count < 0)
+    return false;
+  ids.resize(count);
+  bytes.resize(count);
+  for (int i = 0; i < count; i++)
+    if (fscanf(dag, "%d %d", &ids[i], &bytes[i]) != 2 || bytes[i] < 0)
+      return false;
+  return true;
+}
+
+// Reads every task of stg.dag into graph, indexed by task ID. The 
+// format is
+//   dove-stg 2
+//   tasks <task count> debug <0 or 1> unit <s, ms, us or ns>
+//   <id> <exectime> <pred count> <pred bytes...> <succ count> <succ bytes...>
+// with one line per task, where each pred or succ is a task ID and the
+// size of the message on that edge. Edges are numbered in the order 
+// they appear as successors. Returns false if the file cannot be read
+static bool read_dag(const char* path, std::vector<task> &graph, 
+    bool &debug, uint64_t &ns_per_unit) {
+  FILE* dag = fopen(path, "r");
+  if (dag == NULL)
+    return false;
+
+  int version, tasks, debug_flag = 0;
+  char unit[4];
+  bool ok = fscanf(dag, " dove-stg %d tasks %d debug %d unit %3s", &version,
+      &tasks, &debug_flag, unit) == 4 && version == 2 && tasks >= 0;
+  if (ok)
+    debug = debug_flag != 0;
+  ns_per_unit = ok ? unit_ns(unit) : 0;
+  ok = ok && ns_per_unit != 0;
+
+  graph.assign(ok ? tasks : 0, task());
+  for (int i = 0; i < graph.size(); i++)
+    graph[i].id = -1;
+  for (int i = 0; ok && i < tasks; i++) {
+    task line;
+    ok = fscanf(dag, "%d %llu", &line.id, &line.exectime) == 2 &&
+      line.id >= 0 && line.id < tasks && graph[line.id].id < 0 &&
+      read_edges(dag, line.pred, line.pred_bytes) && 
+      read_edges(dag, line.succ, line.succ_bytes);
+    if (ok)
+      graph[line.id] = line;
+  }
+  fclose(dag);
+  if (!ok)
+    return false;
+
+  int edges = 0;
+  for (int i = 0; i < tasks; i++) {
+    task &t = graph[i];
+    t.pred_edge.assign(t.pred.size(), -1);
+    t.succ_edge.resize(t.succ.size());
+    for (int s = 0; s < t.succ.size(); s++) {
+      if (t.succ[s] < 0 || t.succ[s] >= tasks)
+        return false;
+      t.succ_edge[s] = edges++;
+    }
+  }
+  for (int i = 0; i < tasks; i++)
+    for (int s = 0; s < graph[i].succ.size(); s++) {
+      task &to = graph[graph[i].succ[s]];
+      for (int p = 0; p < to.pred.size(); p++)
+        if (to.pred[p] == i)
+          to.pred_edge[p] = graph[i].succ_edge[s];
+    }
+  for (int i = 0; i < tasks; i++)
+    for (int p = 0; p < graph[i].pred.size(); p++)
+      if (graph[i].pred_edge[p] < 0)
+        return false;
+  return true;
+}
+
+// Reads the workers of every rank from a tasks file. Each line of the
+// file is one worker: "<rank> <cpus> <count> <task IDs...>", where cpus
+// is a comma separated list of OS CPU indices or - to not pin the 
+// worker. If rank_map is given, rank N of the file is run by rank 
+// rank_map[N]. Returns false if the file cannot be read or does not 
+// give every one of the tasks exactly one worker
+static bool read_layout(const char* path, int tasks, 
+    const std::vector<int>* rank_map, layout &l) {
+  FILE* in = fopen(path, "r");
+  if (in == NULL)
+    return false;
+  bool ok = true;
+  l.rank_of.assign(tasks, -1);
+  l.worker_of.assign(tasks, -1);
+  l.workers.clear();
+  int rank, count;
+  char cpus[4096];
+  while (ok && fscanf(in, "%d %4095s %d", &rank, cpus, &count) == 3) {
+    ok = rank >= 0 && count >= 0 && 
+      (rank_map == NULL || rank < rank_map->size());
+    worker w;
+    w.rank = (ok && rank_map != NULL) ? (*rank_map)[rank] : rank;
+    if (strcmp(cpus, "-") != 0)
+      for (char* cpu = strtok(cpus, ","); cpu; cpu = strtok(NULL, ","))
+        w.cpus.push_back(atoi(cpu));
+    for (int i = 0; ok && i < count; i++) {
+      int id;
+      ok = fscanf(in, "%d", &id) == 1 && id >= 0 && id < tasks &&
+        l.rank_of[id] < 0;
+      if (ok) {
+        l.rank_of[id] = w.rank;
+        l.worker_of[id] = l.workers.size();
+        w.tasks.push_back(id);
+      }
+    }
+    l.workers.push_back(w);
+  }
+  ok = ok && feof(in);
+  fclose(in);
+  for (int id = 0; ok && id < tasks; id++)
+    ok = l.rank_of[id] >= 0;
+  return ok;
+}
+
+// The layout without a tasks file, where rank N runs task N alone
+static layout one_task_per_rank(int tasks) {
+  layout l;
+  for (int id = 0; id < tasks; id++) {
+    worker w;
+    w.rank = id;
+    w.tasks.push_back(id);
+    l.workers.push_back(w);
+    l.rank_of.push_back(id);
+    l.worker_of.push_back(id);
+  }
+  return l;
+}
+
+// Reads a campaign file from the generator, which lists every 
+// placement to be run by one launch of this program:
+//   dove-campaign 1
+//   ranks <rank count>
+//   <placement id> <tasks file> <rank count> <rank of each file rank...>
+// with one line per placement, each run runs times. Version 2 files, 
+// which the runner writes to resume a campaign, give each placement 
+// its own run count after its id. Tasks files are relative to the 
+// campaign file. Returns false if any file cannot be read
+static bool read_campaign(const char* path, int tasks, int runs, 
+    int &ranks, std::vector<int> &ids, std::vector<int> &run_counts, 
+    std::vector<layout> &layouts) {
+  FILE* in = fopen(path, "r");
+  if (in == NULL)
+    return false;
+  std::vector<char> copy(path, path + strlen(path) + 1);
+  std::string dir = dirname(&copy[0]);
+
+  int version;
+  bool ok = fscanf(in, " dove-campaign %d ranks %d", &version, &ranks) == 2
+    && (version == 1 || version == 2) && ranks >= 0;
+  int id, count;
+  char file[4096];
+  while (ok && fscanf(in, "%d", &id) == 1) {
+    int placement_runs = runs;
+    if (version == 2)
+      ok = fscanf(in, "%d", &placement_runs) == 1 && placement_runs >= 0;
+    ok = ok && fscanf(in, "%4095s %d", file, &count) == 2 && count >= 0;
+    if (!ok)
+      break;
+    std::vector<int> rank_map(count);
+    for (int r = 0; ok && r < count; r++)
+      ok = fscanf(in, "%d", &rank_map[r]) == 1 && rank_map[r] >= 0 && 
+        rank_map[r] < ranks;
+    layout l;
+    ok = ok && read_layout((dir + "/" + file).c_str(), tasks, &rank_map, l);
+    ids.push_back(id);
+    run_counts.push_back(placement_runs);
+    layouts.push_back(l);
+  }
+  ok = ok && feof(in);
+  fclose(in);
+  return ok;
+}
+
+// Pins the calling thread to cpus
+static bool pin_thread(const std::vector<int> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int c = 0; c < cpus.size(); c++)
+    CPU_SET(cpus[c], &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// Completion flags for the tasks of one rank, shared by its workers. 
+// A flag is 0 while its task runs, 2 once a waiter may be asleep on 
+// it, and 1 when the task is done
+class task_flags {
+  std::unique_ptr<std::atomic<int>[]> flags_;
+
+  static long futex(std::atomic<int> &flag, int op, int value) {
+    return syscall(SYS_futex, reinterpret_cast<int*>(&flag), op, value, 
+        NULL, NULL, 0);
+  }
+
+  public:
+    task_flags(int tasks) : flags_(new std::atomic<int>[tasks]) {
+      for (int t = 0; t < tasks; t++)
+        flags_[t].store(0);
+    }
+
+    bool is_done(int task) const { return flags_[task].load() == 1; }
+
+    void set_done(int task) {
+      if (flags_[task].exchange(1, std::memory_order_release) == 2)
+        futex(flags_[task], FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+
+    // Spins while the waker is likely still computing on another core,
+    // then sleeps until set_done
+    void wait(int task) {
+      std::atomic<int> &flag = flags_[task];
+      for (int spin = 0; spin < 4096; spin++)
+        if (flag.load(std::memory_order_acquire) == 1)
+          return;
+      int expected = 0;
+      flag.compare_exchange_strong(expected, 2);
+      while (flag.load(std::memory_order_acquire) != 1)
+        futex(flag, FUTEX_WAIT_PRIVATE, 2);
+    }
+};
+
+// The perf_event counters every rank reads around a run, by the names
+// the runner records them under
+static const int counter_count = 5;
+static const char* counter_names[counter_count] = {"cycles", 
+  "instructions", "llc_misses", "context_switches", "cpu_migrations"};
+
+// Counts the events of counter_names in this rank and every worker 
+// thread it starts. A counter the kernel will not open,
+// e.g. in a VM without a PMU, is left out
+class run_counters {
+  int fds_[counter_count];
+
+  public:
+    run_counters() {
+      uint32_t types[counter_count] = {PERF_TYPE_HARDWARE, 
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE, 
+        PERF_TYPE_SOFTWARE};
+      // The generic cache miss event is the last level cache on x86
+      uint64_t configs[counter_count] = {PERF_COUNT_HW_CPU_CYCLES, 
+        PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, 
+        PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS};
+      for (int c = 0; c < counter_count; c++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[c];
+        attr.config = configs[c];
+        attr.disabled = 1;
+        attr.inherit = 1;
+        // Switches and migrations happen in the kernel, so only the
+        // hardware events are limited to user space
+        attr.exclude_kernel = types[c] == PERF_TYPE_HARDWARE;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+          PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds_[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      }
+    }
+
+    ~run_counters() {
+      for (int c = 0; c < counter_count; c++)
+        if (fds_[c] >= 0)
+          close(fds_[c]);
+    }
+
+    void start() {
+      for (int c = 0; c < counter_count; c++)
+        if (fds_[c] >= 0) {
+          ioctl(fds_[c], PERF_EVENT_IOC_RESET, 0);
+          ioctl(fds_[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // Stops counting once every worker thread has exited, and gives the
+    // count of each event, scaled up for any time the kernel had it 
+    // switched out to share the PMU. opened is 0 for missing counters
+    void stop(unsigned long long* counts, int* opened) {
+      for (int c = 0; c < counter_count; c++) {
+        counts[c] = 0;
+        opened[c] = 0;
+        uint64_t value[3];
+        if (fds_[c] < 0)
+          continue;
+        ioctl(fds_[c], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fds_[c], value, sizeof(value)) != sizeof(value))
+          continue;
+        opened[c] = 1;
+        counts[c] = value[0];
+        if (value[2] > 0 && value[2] < value[1])
+          counts[c] = (unsigned long long) 
+            ((double) value[0] * value[1] / value[2]);
+      }
+    }
+};
+
+// Estimates how far rank 0's monotonic clock is ahead of this rank's, 
+// in ns. Each host leader times a few round trips to rank 0 and keeps 
+// the one with the shortest round trip. Other ranks share their 
+// leader's clock, and so its offset
+static int64_t clock_offset(MPI_Comm host) {
+  int rank, host_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_rank(host, &host_rank);
+  MPI_Comm leaders;
+  MPI_Comm_split(MPI_COMM_WORLD, host_rank == 0 ? 0 : MPI_UNDEFINED, rank,
+      &leaders);
+
+  int64_t offset = 0;
+  if (leaders != MPI_COMM_NULL) {
+    const int rounds = 10;
+    int leader, count;
+    MPI_Comm_rank(leaders, &leader);
+    MPI_Comm_size(leaders, &count);
+    if (leader == 0) {
+      for (int l = 1; l < count; l++)
+        for (int i = 0; i < rounds; i++) {
+          int64_t now;
+          MPI_Recv(&now, 1, MPI_INT64_T, l, 0, leaders, MPI_STATUS_IGNORE);
+          now = monotonic_ns();
+          MPI_Send(&now, 1, MPI_INT64_T, l, 0, leaders);
+        }
+    } else {
+      int64_t best_round_trip = INT64_MAX;
+      for (int i = 0; i < rounds; i++) {
+        int64_t sent = monotonic_ns(), remote;
+        MPI_Send(&sent, 1, MPI_INT64_T, 0, 0, leaders);
+        MPI_Recv(&remote, 1, MPI_INT64_T, 0, 0, leaders, MPI_STATUS_IGNORE);
+        int64_t back = monotonic_ns();
+        if (back - sent < best_round_trip) {
+          best_round_trip = back - sent;
+          offset = remote - (sent + back) / 2;
+        }
+      }
+    }
+    MPI_Comm_free(&leaders);
+  }
+  MPI_Bcast(&offset, 1, MPI_INT64_T, 0, host);
+  return offset;
+}
+
+// The buffers and requests of one worker's messages, indexed by the 
+// worker's tasks in order. Every send reads the same buffer
+struct worker_state {
+  std::vector<std::vector<std::vector<char> > > recv_buf;
+  std::vector<std::vector<MPI_Request> > recv_req;
+  std::vector<std::vector<MPI_Request> > send_req;
+  std::vector<char> send_buf;
+};
+
+// Allocates and touches one worker's buffers and posts all of its 
+// receives, so that neither page faults nor allocation are timed
+static void prepare_worker(const std::vector<task> &graph, const layout &l,
+    int me, worker_state &state) {
+  const std::vector<int> &rank_of = l.rank_of;
+  const std::vector<int> &mine = l.workers[me].tasks;
+  int rank = l.workers[me].rank;
+
+  state.recv_buf.resize(mine.size());
+  state.recv_req.resize(mine.size());
+  state.send_req.resize(mine.size());
+  int send_size = 0;
+  for (int m = 0; m < mine.size(); m++) {
+    const task &t = graph[mine[m]];
+    std::vector<std::vector<char> > &recv_buf = state.recv_buf[m];
+    std::vector<MPI_Request> &recv_req = state.recv_req[m];
+    recv_buf.resize(t.pred.size());
+    for (int p = 0; p < t.pred.size(); p++) {
+      if (rank_of[t.pred[p]] == rank)
+        continue;
+      recv_buf[p].assign(t.pred_bytes[p], 0);
+      recv_req.push_back(MPI_REQUEST_NULL);
+      MPI_Irecv(recv_buf[p].empty() ? NULL : &recv_buf[p][0], 
+          t.pred_bytes[p], MPI_BYTE, rank_of[t.pred[p]], t.pred_edge[p], 
+          MPI_COMM_WORLD, &recv_req.back());
+    }
+    int sends = 0;
+    for (int p = 0; p < t.succ.size(); p++)
+      if (rank_of[t.succ[p]] != rank) {
+        send_size = std::max(send_size, t.succ_bytes[p]);
+        sends++;
+      }
+    state.send_req[m].reserve(sends);
+  }
+  state.send_buf.assign(send_size, 1);
+}
+
+// Runs one worker's tasks in order, filling in one trace per task with
+// times relative to the monotonic time base. Every receive was posted 
+// by prepare_worker, and sends are only waited on once the last task 
+// has computed, so that a worker never stalls on successors
+static void run_worker(const std::vector<task> &graph, const layout &l,
+    int me, worker_state &state, task_flags &done, bool debug, 
+    uint64_t ns_per_unit, double ticks_per_ns, int64_t base, 
+    trace_record* traces) {
+  const std::vector<int> &rank_of = l.rank_of;
+  const std::vector<int> &worker_of = l.worker_of;
+  const std::vector<int> &mine = l.workers[me].tasks;
+  int rank = l.workers[me].rank;
+  std::vector<std::vector<MPI_Request> > &recv_req = state.recv_req;
+  std::vector<std::vector<MPI_Request> > &send_req = state.send_req;
+  std::vector<char> &send_buf = state.send_buf;
+
+  for (int m = 0; m < mine.size(); m++) {
+    const task &t = graph[mine[m]];
+    int tid = t.id;
+    trace_record &trace = traces[m];
+    trace.task = tid;
+    trace.rank = rank;
+    trace.wake = monotonic_ns() - base;
+    if (debug)
+      std::cout << tid << ": Awake" << std::endl;
+
+    // ========= Receive Predecessors
+    for (int p = 0; p < t.pred.size(); p++) {
+      if (rank_of[t.pred[p]] != rank)
+        continue;
+      if (worker_of[t.pred[p]] == me) {
+        if (!done.is_done(t.pred[p])) {
+          fprintf(stderr, "%d: Task %d is listed before its predecessor %d\n",
+              rank, tid, t.pred[p]);
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+      } else
+        done.wait(t.pred[p]);
+    }
+    if (recv_req[m].size() != 0)
+      MPI_Waitall(recv_req[m].size(), &recv_req[m][0], MPI_STATUSES_IGNORE);
+    if (debug)
+      for (int p = 0; p < t.pred.size(); p++)
+        std::cout << tid << ": Recv notice from pred " << t.pred[p] << std::endl;
+
+    // ========= Perform Computation
+    if (debug)
+      std::cout << tid << ": Started compute" << std::endl;
+    trace.start = monotonic_ns() - base;
+    compute((uint64_t) (t.exectime * ns_per_unit * ticks_per_ns));
+    trace.compute_end = monotonic_ns() - base;
+    if (debug) {
+      uint64_t elapsed = trace.compute_end - trace.start;
+      std::cout << tid << ": Finished compute in " << 
+        elapsed / 1000000000ULL << "s," << elapsed % 1000000000ULL << std::endl;
+    }
+
+    // ========= Send to Successors
+    done.set_done(tid);
+    for (int p = 0; p < t.succ.size(); p++) {
+      if (rank_of[t.succ[p]] == rank)
+        continue;
+      send_req[m].push_back(MPI_REQUEST_NULL);
+      MPI_Isend(send_buf.empty() ? NULL : &send_buf[0], t.succ_bytes[p], 
+          MPI_BYTE, rank_of[t.succ[p]], t.succ_edge[p], MPI_COMM_WORLD, 
+          &send_req[m].back());
+    }
+    if (debug) {
+      for (int p = 0; p < t.succ.size(); p++)
+        std::cout << tid << ": Sent notice to succ " << t.succ[p] << std::endl;
+      if (t.succ.size() == 0)
+        std::cout << tid << ": DONE!!" << std::endl;
+    }
+  }
+
+  for (int m = 0; m < mine.size(); m++) {
+    if (send_req[m].size() != 0)
+      MPI_Waitall(send_req[m].size(), &send_req[m][0], MPI_STATUSES_IGNORE);
+    traces[m].send_end = std::max<int64_t>(monotonic_ns() - base, 
+        traces[m].compute_end);
+  }
+}
+
+// Gathers every rank's traces and host name to rank 0, which writes one
+// line per task to path
+static void write_trace(const char* path, 
+    const std::vector<trace_record> &traces) {
+  int rank, ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  char name[MPI_MAX_PROCESSOR_NAME] = {0};
+  int length;
+  MPI_Get_processor_name(name, &length);
+
+  int bytes = traces.size() * sizeof(trace_record);
+  std::vector<int> counts(rank == 0 ? ranks : 0);
+  MPI_Gather(&bytes, 1, MPI_INT, rank == 0 ? &counts[0] : NULL, 1, MPI_INT,
+      0, MPI_COMM_WORLD);
+  std::vector<int> offsets(counts.size(), 0);
+  for (int r = 1; r < counts.size(); r++)
+    offsets[r] = offsets[r - 1] + counts[r - 1];
+  std::vector<trace_record> all(rank == 0 ? 
+      (offsets.back() + counts.back()) / sizeof(trace_record) : 0);
+  MPI_Gatherv(traces.empty() ? NULL : (void*) &traces[0], bytes, MPI_BYTE,
+      all.empty() ? NULL : &all[0], 
+      rank == 0 ? &counts[0] : NULL, rank == 0 ? &offsets[0] : NULL, 
+      MPI_BYTE, 0, MPI_COMM_WORLD);
+
+  std::vector<char> names(rank == 0 ? ranks * MPI_MAX_PROCESSOR_NAME : 0);
+  MPI_Gather(name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, 
+      rank == 0 ? &names[0] : NULL, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, 
+      0, MPI_COMM_WORLD);
+  if (rank != 0)
+    return;
+
+  FILE* out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "0: Unable to write trace to %s\n", path);
+    return;
+  }
+  fprintf(out, "# task rank host wake start compute_end send_end (ns)\n");
+  for (int i = 0; i < all.size(); i++)
+    fprintf(out, "%lld %lld %s %lld %lld %lld %lld\n", 
+        (long long) all[i].task, (long long) all[i].rank, 
+        &names[all[i].rank * MPI_MAX_PROCESSOR_NAME],
+        (long long) all[i].wake, (long long) all[i].start, 
+        (long long) all[i].compute_end, (long long) all[i].send_end);
+  fclose(out);
+}
+
+// This rank's part of one layout, set up so that a run can be timed on
+// its own. Creating it allocates every buffer, posts every receive and,
+// if the rank has several workers, starts and pins their threads, which
+// then wait for run(). Each object is run exactly once
+class layout_run {
+  const std::vector<task> &graph_;
+  const layout &l_;
+  int rank_;
+  bool debug_;
+  uint64_t ns_per_unit_;
+  double ticks_per_ns_;
+  int64_t base_;
+  // This rank's workers, each with a slice of traces for its tasks
+  std::vector<int> mine_;
+  std::vector<int> first_trace_;
+  std::vector<worker_state> states_;
+  std::vector<trace_record> traces_;
+  task_flags done_;
+  // Task 0 is marked done when the run starts
+  task_flags go_;
+  std::vector<std::thread> threads_;
+
+  void pin(int m) {
+    const worker &w = l_.workers[mine_[m]];
+    if (!w.cpus.empty() && !pin_thread(w.cpus))
+      fprintf(stderr, "%d: Unable to pin a worker to its CPUs\n", rank_);
+  }
+
+  void run_one(int m) {
+    run_worker(graph_, l_, mine_[m], states_[m], done_, debug_, 
+        ns_per_unit_, ticks_per_ns_, base_, 
+        traces_.empty() ? NULL : &traces_[first_trace_[m]]);
+  }
+
+  public:
+    layout_run(const std::vector<task> &graph, const layout &l, int rank,
+        bool debug, uint64_t ns_per_unit, double ticks_per_ns, int64_t base)
+      : graph_(graph), l_(l), rank_(rank), debug_(debug), 
+      ns_per_unit_(ns_per_unit), ticks_per_ns_(ticks_per_ns), base_(base),
+      done_(graph.size()), go_(1) {
+      int task_count = 0;
+      for (int w = 0; w < l.workers.size(); w++)
+        if (l.workers[w].rank == rank) {
+          mine_.push_back(w);
+          first_trace_.push_back(task_count);
+          task_count += l.workers[w].tasks.size();
+        }
+      traces_.resize(task_count);
+      states_.resize(mine_.size());
+      for (int m = 0; m < mine_.size(); m++)
+        prepare_worker(graph, l, mine_[m], states_[m]);
+
+      // A single worker runs on the calling thread
+      if (mine_.size() == 1)
+        pin(0);
+      else
+        for (int m = 0; m < mine_.size(); m++)
+          threads_.push_back(std::thread([this, m]() {
+            pin(m);
+            go_.wait(0);
+            run_one(m);
+          }));
+    }
+
+    // Runs every worker, and returns once all of them have finished
+    void run() {
+      if (mine_.size() == 1)
+        run_one(0);
+      go_.set_done(0);
+      for (int t = 0; t < threads_.size(); t++)
+        threads_[t].join();
+    }
+
+    const std::vector<trace_record>& traces() const { return traces_; }
+};
+
+// Number of ranks a layout needs, and whether any of them has more 
+// than one worker
+static void count_ranks(const layout &l, int &ranks, bool &threaded) {
+  std::vector<int> workers_per_rank;
+  for (int w = 0; w < l.workers.size(); w++) {
+    if (l.workers[w].rank >= workers_per_rank.size())
+      workers_per_rank.resize(l.workers[w].rank + 1, 0);
+    if (++workers_per_rank[l.workers[w].rank] > 1)
+      threaded = true;
+  }
+  ranks = std::max<int>(ranks, workers_per_rank.size());
+}
+
+int main(int argc, char* argv[]) {
+  std::string path;
+  const char* trace_path = NULL;
+  const char* tasks_path = NULL;
+  const char* campaign_path = NULL;
+  const char* results_path = NULL;
+  int runs = 1;
+  for (int a = 1; a < argc; a++) {
+    if (strcmp(argv[a], "--trace") == 0 && a + 1 < argc)
+      trace_path = argv[++a];
+    else if (strcmp(argv[a], "--tasks") == 0 && a + 1 < argc)
+      tasks_path = argv[++a];
+    else if (strcmp(argv[a], "--campaign") == 0 && a + 1 < argc)
+      campaign_path = argv[++a];
+    else if (strcmp(argv[a], "--results") == 0 && a + 1 < argc)
+      results_path = argv[++a];
+    else if (strcmp(argv[a], "--runs") == 0 && a + 1 < argc)
+      runs = std::max(atoi(argv[++a]), 1);
+    else
+      path = argv[a];
+  }
+  if (path.empty()) {
+    std::vector<char> self(argv[0], argv[0] + strlen(argv[0]) + 1);
+    path = dirname(&self[0]);
+    path += "/stg.dag";
+  }
+
+  // Every file is read before MPI starts, as the thread support to ask
+  // for depends on whether any rank has more than one worker. Errors 
+  // are reported once MPI is up
+  std::vector<task> graph;
+  bool debug = false;
+  uint64_t ns_per_unit = 0;
+  bool dag_ok = read_dag(path.c_str(), graph, debug, ns_per_unit);
+
+  // Campaigns run each placement its number of runs in one launch. 
+  // Otherwise the one layout is run once
+  std::vector<int> placement_ids;
+  std::vector<int> run_counts;
+  std::vector<layout> layouts;
+  int needed_ranks = 0;
+  bool files_ok = true;
+  if (campaign_path != NULL)
+    files_ok = read_campaign(campaign_path, graph.size(), runs, 
+        needed_ranks, placement_ids, run_counts, layouts);
+  else {
+    layouts.resize(1);
+    placement_ids.push_back(0);
+    if (tasks_path != NULL)
+      files_ok = read_layout(tasks_path, graph.size(), NULL, layouts[0]);
+    else
+      layouts[0] = one_task_per_rank(graph.size());
+  }
+  bool threaded = false;
+  for (int l = 0; l < layouts.size(); l++)
+    count_ranks(layouts[l], needed_ranks, threaded);
+
+  int provided;
+  MPI_Init_thread(&argc, &argv, 
+      threaded ? MPI_THREAD_MULTIPLE : MPI_THREAD_SINGLE, &provided);
+  int rank, ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  if (!dag_ok) {
+    fprintf(stderr, "%d: Unable to read STG from %s\n", rank, path.c_str());
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  if (!files_ok) {
+    fprintf(stderr, "%d: Unable to read tasks from %s\n", rank, 
+        campaign_path != NULL ? campaign_path : tasks_path);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  if (needed_ranks > ranks) {
+    fprintf(stderr, "%d: %d ranks cannot run tasks meant for %d ranks\n", 
+        rank, ranks, needed_ranks);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  if (threaded && provided < MPI_THREAD_MULTIPLE) {
+    fprintf(stderr, "%d: MPI does not support MPI_THREAD_MULTIPLE, which "
+        "ranks with several workers need\n", rank);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  // Edge IDs are message tags, which MPI may limit to 32767
+  int edges = 0;
+  for (int id = 0; id < graph.size(); id++)
+    edges += graph[id].succ.size();
+  int* tag_ub;
+  int has_tag_ub;
+  MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tag_ub, &has_tag_ub);
+  if (has_tag_ub && edges - 1 > *tag_ub) {
+    fprintf(stderr, "%d: The STG has more edges than MPI has tags\n", rank);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  // Every rank takes part, as calibration is collective on each host
+  MPI_Comm host;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, 
+      MPI_INFO_NULL, &host);
+  double ticks_per_ns = calibrate_cycles(host);
+
+  // Traces are on rank 0's clock, starting when rank 0 left a barrier
+  // that every rank passes before running its tasks
+  int64_t base = 0;
+  if (trace_path != NULL) {
+    int64_t offset = clock_offset(host);
+    MPI_Barrier(MPI_COMM_WORLD);
+    int64_t epoch = monotonic_ns();
+    MPI_Bcast(&epoch, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    base = epoch - offset;
+  }
+  MPI_Comm_free(&host);
+
+  if (campaign_path == NULL) {
+    // The makespan runs from a barrier to the last rank's last send, 
+    // leaving out launch, MPI_Init, setting up buffers and threads, and
+    // teardown. Each rank times itself from leaving the barrier, and 
+    // rank 0 prints the longest
+    run_counters counters;
+    layout_run prepared(graph, layouts[0], rank, debug, ns_per_unit, 
+        ticks_per_ns, base);
+    MPI_Barrier(MPI_COMM_WORLD);
+    counters.start();
+    uint64_t start = monotonic_ns();
+    prepared.run();
+    unsigned long long elapsed = monotonic_ns() - start;
+    unsigned long long counts[counter_count];
+    int opened[counter_count];
+    counters.stop(counts, opened);
+
+    unsigned long long makespan = 0;
+    MPI_Reduce(&elapsed, &makespan, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, 0,
+        MPI_COMM_WORLD);
+    // Counts are summed over every rank on every host, and only given
+    // for counters that every rank could open
+    unsigned long long totals[counter_count];
+    int everywhere[counter_count];
+    MPI_Reduce(counts, totals, counter_count, MPI_UNSIGNED_LONG_LONG, 
+        MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(opened, everywhere, counter_count, MPI_INT, MPI_MIN, 0, 
+        MPI_COMM_WORLD);
+    if (rank == 0) {
+      printf("dove-makespan %llu\n", makespan);
+      printf("dove-counters");
+      for (int c = 0; c < counter_count; c++)
+        if (everywhere[c])
+          printf(" %s %llu", counter_names[c], totals[c]);
+      printf("\n");
+      fflush(stdout);
+    }
+    if (trace_path != NULL)
+      write_trace(trace_path, prepared.traces());
+  } else {
+    // Each run is timed like a single run: from a barrier to the last 
+    // rank's last send, as the longest time any rank took after 
+    // leaving the barrier. A rank's sends and receives of one run have
+    // all completed before it returns, so no message crosses into the
+    // next run. Each run is set up before its barrier
+    FILE* results = NULL;
+    if (rank == 0 && results_path != NULL) {
+      results = fopen(results_path, "w");
+      if (results == NULL)
+        fprintf(stderr, "0: Unable to write results to %s\n", results_path);
+    }
+    for (int l = 0; l < layouts.size(); l++)
+      for (int r = 0; r < run_counts[l]; r++) {
+        layout_run prepared(graph, layouts[l], rank, debug, ns_per_unit, 
+            ticks_per_ns, base);
+        MPI_Barrier(MPI_COMM_WORLD);
+        uint64_t start = monotonic_ns();
+        prepared.run();
+        unsigned long long elapsed = monotonic_ns() - start;
+        unsigned long long makespan = 0;
+        MPI_Reduce(&elapsed, &makespan, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX,
+            0, MPI_COMM_WORLD);
+        if (rank != 0)
+          continue;
+        if (results != NULL)
+          fprintf(results, "%d %d %llu\n", placement_ids[l], r, makespan);
+        else
+          printf("%d %d %llu\n", placement_ids[l], r, makespan);
+      }
+    if (results != NULL)
+      fclose(results);
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,79 @@
+// Unit tests of the generator's placement dedupe. Run with make check
+#include <stdio.h>
+
+#include "../placements.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  if (!(condition)) { \
+    fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+    failures++; \
+  }
+
+static placement_plan plan(int count, const int* pairs) {
+  placement_plan p;
+  for (int i = 0; i < count; i++)
+    p.push_back(std::make_pair(pairs[2 * i], pairs[2 * i + 1]));
+  return p;
+}
+
+static void test_hash() {
+  // FNV-1a of nothing is its offset basis
+  CHECK(hash_placement(placement_plan()) == 14695981039346656037ULL);
+
+  const int a[] = {0, 1, 1, 2};
+  const int swapped[] = {0, 2, 1, 1};
+  CHECK(hash_placement(plan(2, a)) == hash_placement(plan(2, a)));
+  CHECK(hash_placement(plan(2, a)) != hash_placement(plan(2, swapped)));
+}
+
+static void test_dedupe() {
+  const int a[] = {0, 1, 1, 2, 1, 3};
+  const int same_as_a[] = {0, 1, 1, 2, 1, 3};
+  // Tasks on one unit run in order, so this is another placement
+  const int reordered[] = {0, 1, 1, 3, 1, 2};
+  const int b[] = {2, 1, 2, 2, 3, 3};
+
+  placement_set placements(true);
+  CHECK(placements.add(plan(3, a)) == 0);
+  CHECK(placements.add(plan(3, b)) == 1);
+  CHECK(placements.add(plan(3, same_as_a)) == 0);
+  CHECK(placements.add(plan(3, reordered)) == 2);
+  CHECK(placements.add(plan(3, b)) == 1);
+  CHECK(placements.size() == 3);
+  CHECK(placements[2] == plan(3, reordered));
+}
+
+static void test_nodedupe() {
+  const int a[] = {0, 1, 1, 2};
+
+  placement_set placements(false);
+  CHECK(placements.add(plan(2, a)) == 0);
+  CHECK(placements.add(plan(2, a)) == 1);
+  CHECK(placements.size() == 2);
+}
+
+// A deployment that places nothing is a placement like any other
+static void test_empty() {
+  const int a[] = {1, 0};
+
+  placement_set placements(true);
+  CHECK(placements.add(placement_plan()) == 0);
+  CHECK(placements.add(plan(1, a)) == 1);
+  CHECK(placements.add(placement_plan()) == 0);
+  CHECK(placements[0].empty());
+}
+
+int main() {
+  test_hash();
+  test_dedupe();
+  test_nodedupe();
+  test_empty();
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
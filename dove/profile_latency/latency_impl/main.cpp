@@ -19,6 +19,8 @@
 // 1000*10*10        750 seconds
 // 1000*100*100
 #define	NUMBER_REPS	10000000
+// Messages sent one way per bandwidth test
+#define	BANDWIDTH_REPS	100
 
 #ifdef DEBUG_LATENCY
  #define debug true
@@ -26,6 +28,38 @@
  #define debug false
 #endif
 
+/* Bandwidth test: task 0 streams BANDWIDTH_REPS messages of the given 
+ * size to task 1, which replies with one byte once it has all of them. 
+ * Task 0 prints the bandwidth in MB/s, the unit of the b attribute of a
+ * <d> tag in system.xml */
+static void bandwidth_test(int bytes, int rank)
+{
+char *buf = (char*) calloc(bytes > 0 ? bytes : 1, 1);
+char ack = 'x';
+double T1, T2;
+int n;
+
+/* One message first, so that connection setup is not timed */
+if (rank == 0) {
+   MPI_Send(buf, bytes, MPI_BYTE, 1, 2, MPI_COMM_WORLD);
+   MPI_Recv(&ack, 1, MPI_BYTE, 1, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   T1 = MPI_Wtime();
+   for (n = 0; n < BANDWIDTH_REPS; n++)
+      MPI_Send(buf, bytes, MPI_BYTE, 1, 2, MPI_COMM_WORLD);
+   MPI_Recv(&ack, 1, MPI_BYTE, 1, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   T2 = MPI_Wtime();
+   printf("%.1f", (double) bytes * BANDWIDTH_REPS / (T2 - T1) / 1000000.0);
+   }
+else if (rank == 1) {
+   MPI_Recv(buf, bytes, MPI_BYTE, 0, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   MPI_Send(&ack, 1, MPI_BYTE, 0, 2, MPI_COMM_WORLD);
+   for (n = 0; n < BANDWIDTH_REPS; n++)
+      MPI_Recv(buf, bytes, MPI_BYTE, 0, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   MPI_Send(&ack, 1, MPI_BYTE, 0, 2, MPI_COMM_WORLD);
+   }
+free(buf);
+}
+
 // TODO I'm not sure if there is such a thing as warming up the 
 // network when doing core-core routing, but if there is then we
 // are finding the average of 1000s of iterations, which effectively
@@ -57,6 +91,13 @@ if (rank == 0 && numtasks != 2) {
    }
 MPI_Barrier(MPI_COMM_WORLD);
 
+/* Given a message size in bytes, measure bandwidth instead */
+if (argc > 1) {
+   bandwidth_test(atoi(argv[1]), rank);
+   MPI_Finalize();
+   exit(0);
+   }
+
 sumT = 0;
 msg = 'x';
 tag = 1;
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h> // mkstemp
+#include <unistd.h> // unlink, close
 #include <iostream>
 
 // Provides regex and exec 
@@ -21,16 +22,8 @@
 
 #include "dove.h"
 
-// Each pass of the -v flag raises this by one
-// 0 prints errors
-// 1 prints info
-// 2 prints debug
-static int log_level = 0;
-void log(const char* msg, int level) {  if (level <= log_level) std::cout << 
-  "profile: " << msg << std::endl; }
-void info(const char* msg) { log(msg, 1); }
-void error(const char* msg) { log(msg, 0); }
-void debug(const char* msg) { log(msg, 2); }
+using dove::info;
+using dove::error;
 
 // Function declarations
 void calculate_latency(std::vector<int> ids);
@@ -46,12 +39,19 @@ rapidxml::xml_document<char>* xml;
 std::string xml_filepath;
 rapidxml::file<char>* xml_file;
 
+// Logical ID lookups into the XML, built once it has been parsed
+dove::system_index* sys_index;
+
 // If true, the latency is not actually profiled 
 static bool dry_run = false;
 
 // If true, progress will be printed as latency is calculated
 static bool print_progress = false;
 
+// Size in bytes of the messages used to measure the bandwidth between 
+// each pair, or 0 to measure latency only
+static int bandwidth_bytes = 0;
+
 // Logical IDs of all hardware that should have
 // latency profiled. Each vector is used to generate
 // pair-pair combinations
@@ -104,13 +104,13 @@ int main(int argc, char** argv) {
     exit(EXIT_FAILURE);
   }
 
-  // TODO update rapidxml_myutils to enable building of 
-  // ranklines for these other options
-  //
-  //calculate_latency(hosts);
-  //calculate_latency(sockets);
-  //calculate_latency(threads);
+  // Only the levels asked for are filled in. dove derives host, socket
+  // and thread delays from the cores, so the others are only profiled
+  // when named explicitly
   calculate_latency(cores);
+  calculate_latency(hosts);
+  calculate_latency(sockets);
+  calculate_latency(threads);
 
   if (!dry_run) {
     output << *xml;
@@ -137,10 +137,11 @@ std::string make_rankfile(std::string to, std::string from) {
         return "";
     }
 
-    // TODO either use the logic in rapidxml_myutils.hpp to 
-    // build ranklines, or move this logic there
-    fprintf(sfp, "rank 0=10.0.2.4 slot=p0:%s\n", to.c_str());
-    fprintf(sfp, "rank 1=10.0.2.4 slot=p0:%s\n", from.c_str());
+    fprintf(sfp, "%s", dove::build_rankline(*sys_index, 0, 
+          atoi(to.c_str())).c_str());
+    fprintf(sfp, "%s", dove::build_rankline(*sys_index, 1, 
+          atoi(from.c_str())).c_str());
+    fclose(sfp);
 
     // TODO: This isn't returning a value on the stack, is it?
     return std::string(sfn);
@@ -172,6 +173,19 @@ std::string write_latency(std::string from, std::string to) {
       info(command.c_str());
     else
       result = exec(command);
+
+    // The same pair again, streaming large messages, gives the b 
+    // attribute in MB/s
+    string bandwidth;
+    if (bandwidth_bytes > 0) {
+      std::stringstream bytes;
+      bytes << bandwidth_bytes;
+      string bw_command = command + " " + bytes.str();
+      if (dry_run)
+        info(bw_command.c_str());
+      else
+        bandwidth = exec(bw_command);
+    }
     
     // TODO somehow deal with both cases e.g. latency_bin built with and 
     // without DEBUG
@@ -193,6 +207,9 @@ std::string write_latency(std::string from, std::string to) {
       delay->append_attribute(fattr);
       delay->append_attribute(tattr);
       delay->append_attribute(vattr);
+      if (!bandwidth.empty())
+        delay->append_attribute(xml->allocate_attribute("b", 
+              s(bandwidth.c_str())));
 
       // Find the right place in the XML
       rapidxml::xml_node<char>* system = xml->first_node("system");
@@ -263,40 +280,18 @@ void calculate_latency(std::vector<int> ids) {
 }
 
 // Given parsed command-line options, this builds the lists that 
-// are used to generate pair-pair combinations
+// are used to generate pair-pair combinations. All only covers the cores,
+// as every other level is derived from them
 void build_main_filter(bool all, bool host, bool socket, bool core, 
     bool thread) {
-  typedef rapidxml::xml_node<char> xml_node;
-  typedef std::vector<xml_node*> xml_node_vector; 
-
-  if (all || host) {
-    xml_node_vector xhosts = dove::get_all_hosts(*xml);
-    for (xml_node_vector::iterator it = xhosts.begin();
-        it != xhosts.end();
-        ++it)
-    hosts.push_back(atoi((*it)->first_attribute("id")->value()));
-  }
-  if (all || socket) {
-    xml_node_vector xprocs = dove::get_all_processors(*xml);
-    for (xml_node_vector::iterator it = xprocs.begin();
-        it != xprocs.end();
-        ++it)
-    sockets.push_back(atoi((*it)->first_attribute("id")->value()));
-  }
-  if (all || core) {
-    xml_node_vector xcores = dove::get_all_cores(*xml);
-    for (xml_node_vector::iterator it = xcores.begin();
-        it != xcores.end();
-        ++it)
-    cores.push_back(atoi((*it)->first_attribute("id")->value()));
-  }
-  if (all || thread) {
-    xml_node_vector xhw = dove::get_all_threads(*xml);
-    for (xml_node_vector::iterator it = xhw.begin();
-        it != xhw.end();
-        ++it)
-    threads.push_back(atoi((*it)->first_attribute("id")->value()));
-  }
+  if (host)
+    hosts = sys_index->get_ids(dove::HOST);
+  if (socket)
+    sockets = sys_index->get_ids(dove::SOCKET);
+  if (all || core)
+    cores = sys_index->get_ids(dove::CORE);
+  if (thread)
+    threads = sys_index->get_ids(dove::HW_THREAD);
 
   //std::cerr << "Size of host: " << hosts.size() << std::endl;
   //std::cerr << "Size of socket: " << sockets.size() << std::endl;
@@ -322,11 +317,18 @@ static void parse_options(int argc, char *argv[]) {
       "dove is undefined", cmd);
   TCLAP::SwitchArg show_progress("p", "progress", "With this flag, progress "
       "will be reported as the program is executing", cmd);
+  TCLAP::ValueArg<int> bandwidth_arg("b", "bandwidth", "Also measures the "
+      "bandwidth between each pair by streaming messages of this many bytes "
+      "(e.g. 4194304), and records it in MB/s as the b attribute of the "
+      "delay (d) tag. Optimizers need it to model the message sizes in an "
+      "STG's .edges file. Bandwidths are not derived for other levels, so "
+      "profile the level the optimizer will use", false, 0, "bytes", cmd);
 
   // Setup the list of required filters
   TCLAP::SwitchArg all_filter("", "all", "Indicates that latency tests will "
-      "be performed for all host-host,socket-socket,core-core,and thread-thread "
-      "pairs in the XML file. May take a substantial amount of time. "
+      "be performed for all core-core pairs in the XML file, which is all "
+      "dove needs to derive host, socket and thread delays. Use --hosts, "
+      "--sockets or --threads to profile another level directly. "
       "Can be used with additional filters such as core, node, thread.", 
       false);
   TCLAP::SwitchArg host_filter("", "hosts", "Indicates that latency tests will "
@@ -395,6 +397,20 @@ static void parse_options(int argc, char *argv[]) {
   */
   cmd.parse(argc, argv);
 
+  // Each pass of the -v flag raises the dove log level. Without it,
+  // the level comes from DOVE_LOG_LEVEL, or only errors are printed
+  dove::set_log_name("profile");
+  const char* env_level = getenv("DOVE_LOG_LEVEL");
+  if (verbosity.getValue() == 0 && (env_level == 0 || *env_level == '\0'))
+    dove::set_log_level(dove::LOG_ERROR);
+  else if (verbosity.getValue() == 1)
+    dove::set_log_level(dove::LOG_INFO);
+  else if (verbosity.getValue() > 1)
+    dove::set_log_level(dove::LOG_ALL);
+  // Require at least info logging if we are doing a dry run
+  if (dry_filter.getValue() && !dove::log_enabled(dove::LOG_INFO))
+    dove::set_log_level(dove::LOG_INFO);
+
   // Ensure that the given XML path is accessible by rapidxml
   try {
     info("Trying to parse the following xml file:");
@@ -402,6 +418,7 @@ static void parse_options(int argc, char *argv[]) {
     info(xml_filepath.c_str());
     xml_file = new rapidxml::file<char>(xml_arg.getValue().c_str());
     xml->parse<0>(xml_file->data());
+    sys_index = new dove::system_index(*xml);
   } catch (rapidxml::parse_error err) {
     std::cout << "Could not parse XML file. Error was: " << std::endl;
     std::cout << err.what() << std::endl;
@@ -410,11 +427,10 @@ static void parse_options(int argc, char *argv[]) {
   }
 
   print_progress = show_progress.getValue();
+  bandwidth_bytes = bandwidth_arg.getValue();
+  if (bandwidth_bytes < 0)
+    throw TCLAP::ArgException("Message size must not be negative", "bandwidth");
   dry_run = dry_filter.getValue();
-  log_level = verbosity.getValue();
-  // Require at least info logging if we are doing a dry run
-  if (dry_run && log_level==0)
-    log_level = 1;
 
   if (clear_xml.getValue()) {
     if (dry_run) 
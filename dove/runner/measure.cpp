@@ -0,0 +1,119 @@
+#include "measure.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+const char* measure::get_rule_name(stopping_rule rule) {
+  switch (rule) {
+    case STOP_KBEST:     return "kbest";
+    case STOP_CI:        return "ci";
+    case STOP_BOOTSTRAP: return "bootstrap";
+  }
+  return "kbest";
+}
+
+measure::stopping_rule measure::parse_rule(const char* name) {
+  if (strcmp(name, "kbest") == 0)
+    return STOP_KBEST;
+  if (strcmp(name, "ci") == 0)
+    return STOP_CI;
+  if (strcmp(name, "bootstrap") == 0)
+    return STOP_BOOTSTRAP;
+  throw "Unknown stopping rule. Valid values are kbest, ci and bootstrap";
+}
+
+// Median of sorted values
+static double sorted_median(const std::vector<double> &sorted) {
+  size_t n = sorted.size();
+  if (n == 0)
+    return 0;
+  if (n % 2)
+    return sorted[n / 2];
+  return (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+void measure::samples::add(double ns) {
+  runs_.push_back(ns);
+  sorted_.insert(std::upper_bound(sorted_.begin(), sorted_.end(), ns), ns);
+}
+
+double measure::samples::min() const {
+  return sorted_.empty() ? 0 : sorted_[0];
+}
+
+double measure::samples::median() const {
+  return sorted_median(sorted_);
+}
+
+double measure::samples::mad() const {
+  double med = median();
+  std::vector<double> deviations;
+  deviations.reserve(sorted_.size());
+  for (size_t i = 0; i < sorted_.size(); i++)
+    deviations.push_back(fabs(sorted_[i] - med));
+  std::sort(deviations.begin(), deviations.end());
+  return sorted_median(deviations);
+}
+
+bool measure::samples::median_ci(double &low, double &high) const {
+  // The ranks either side of the median that hold it with 95%
+  // probability, from the normal approximation to the binomial
+  double n = sorted_.size();
+  double spread = 1.96 * sqrt(n) / 2;
+  long lower = lround(n / 2 - spread);
+  long upper = lround(n / 2 + 1 + spread);
+  if (lower < 1 || upper > n)
+    return false;
+  low = sorted_[lower - 1];
+  high = sorted_[upper - 1];
+  return true;
+}
+
+double measure::samples::bootstrap_error(int resamples) const {
+  size_t n = runs_.size();
+  double med = median();
+  if (n < 2 || med == 0)
+    return HUGE_VAL;
+
+  unsigned int seed = 1;
+  std::vector<double> resample(n);
+  double sum = 0, sum_sq = 0;
+  for (int r = 0; r < resamples; r++) {
+    for (size_t i = 0; i < n; i++)
+      resample[i] = runs_[rand_r(&seed) % n];
+    std::sort(resample.begin(), resample.end());
+    double m = sorted_median(resample);
+    sum += m;
+    sum_sq += m * m;
+  }
+  double mean = sum / resamples;
+  double variance = std::max(sum_sq / resamples - mean * mean, 0.0);
+  return sqrt(variance) / med;
+}
+
+bool measure::samples::done(stopping_rule rule, int min_runs,
+    double tolerance) const {
+  if (sorted_.empty() || (int) sorted_.size() < std::max(min_runs, 1))
+    return false;
+  switch (rule) {
+    case STOP_KBEST: {
+      size_t k = std::max(min_runs, 1);
+      return (sorted_[k - 1] - sorted_[0]) / sorted_[0] <= tolerance;
+    }
+    case STOP_CI: {
+      double low, high;
+      if (!median_ci(low, high))
+        return false;
+      return (high - low) / 2 / median() <= tolerance;
+    }
+    case STOP_BOOTSTRAP:
+      return bootstrap_error() <= tolerance;
+  }
+  return false;
+}
+
+double measure::samples::estimate(stopping_rule rule) const {
+  return rule == STOP_KBEST ? min() : median();
+}
@@ -0,0 +1,66 @@
+#ifndef __MEASURE_H_INCLUDED__
+#define __MEASURE_H_INCLUDED__
+
+#include <cstddef>
+#include <vector>
+
+// The runner runs each rankfile until a stopping rule says the times
+// seen so far can be trusted, or until it reaches the maximum number of
+// runs. Times are in ns
+namespace measure {
+
+  // Rules that decide when a rankfile has been run often enough. Each
+  // compares against a tolerance that is relative to the time reported
+  enum stopping_rule {
+    // The k fastest runs are within the tolerance of the fastest
+    STOP_KBEST     = 0,
+    // Half the width of the 95% confidence interval of the median is
+    // within the tolerance of the median
+    STOP_CI        = 1,
+    // The bootstrap standard error of the median is within the
+    // tolerance of the median
+    STOP_BOOTSTRAP = 2
+  };
+
+  // Converts between a rule and its name (kbest, ci or bootstrap).
+  // parse_rule throws if the name is unknown
+  const char* get_rule_name(stopping_rule rule);
+  stopping_rule parse_rule(const char* name);
+
+  // The times of every run of one rankfile, in the order they were taken
+  class samples {
+    std::vector<double> runs_;
+    std::vector<double> sorted_;
+
+    public:
+      void add(double ns);
+
+      size_t size() const { return runs_.size(); }
+      const std::vector<double>& runs() const { return runs_; }
+
+      // Summaries of the runs so far. All are 0 when there are none
+      double min() const;
+      double median() const;
+      // Median absolute deviation from the median
+      double mad() const;
+
+      // Distribution-free 95% confidence interval of the median, read
+      // from the order statistics of the runs. Returns false if there
+      // are too few runs (under 6) for one
+      bool median_ci(double &low, double &high) const;
+
+      // Standard error of the median, relative to the median, from
+      // resampling the runs. The resamples come from a fixed seed, so
+      // the same runs always give the same error
+      double bootstrap_error(int resamples = 1000) const;
+
+      // Whether the rule is met. No rule is met before min_runs runs
+      bool done(stopping_rule rule, int min_runs, double tolerance) const;
+
+      // The time a rule reports: the fastest run for k-best, where
+      // noise only ever slows a run down, and the median otherwise
+      double estimate(stopping_rule rule) const;
+  };
+}
+
+#endif
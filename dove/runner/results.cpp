@@ -0,0 +1,87 @@
+#include "results.h"
+
+#include <stdlib.h>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+std::string results::format_run(const std::string &key, int number, 
+    const run &r) {
+  std::stringstream line;
+  line << std::fixed << std::setprecision(0) << key << " " << number << 
+    " " << r.makespan << " ";
+  if (r.wall < 0)
+    line << "-";
+  else
+    line << r.wall;
+  std::map<std::string, double>::const_iterator c;
+  for (c = r.counts.begin(); c != r.counts.end(); c++)
+    line << " " << c->first << " " << c->second;
+  line << "\n";
+  return line.str();
+}
+
+std::string results::format_drop(const std::string &key, int round) {
+  std::stringstream line;
+  line << key << " dropped " << round << "\n";
+  return line.str();
+}
+
+void results::read(std::istream &in, 
+    const std::map<std::string, size_t> &ids,
+    std::vector<std::vector<run> > &runs, std::vector<int> &dropped) {
+  size_t count = 0;
+  std::map<std::string, size_t>::const_iterator id;
+  for (id = ids.begin(); id != ids.end(); id++)
+    count = std::max(count, id->second + 1);
+  runs.assign(count, std::vector<run>());
+  dropped.assign(count, 0);
+  std::vector<std::map<int, run> > logged(count);
+
+  std::string line;
+  while (std::getline(in, line)) {
+    // Only the last line can be cut short, and then it has no newline
+    if (in.eof())
+      break;
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::stringstream fields(line);
+    std::string software, hardware, number;
+    if (!(fields >> software >> hardware >> number))
+      continue;
+    id = ids.find(software + " " + hardware);
+    if (id == ids.end())
+      continue;
+
+    if (number == "dropped") {
+      int round;
+      if (fields >> round && round > 0 && dropped[id->second] == 0)
+        dropped[id->second] = round;
+      continue;
+    }
+
+    std::stringstream number_field(number);
+    int n;
+    run r;
+    std::string wall;
+    if (!(number_field >> n) || !number_field.eof() || n < 0 ||
+        !(fields >> r.makespan >> wall))
+      continue;
+    r.wall = wall == "-" ? -1 : atof(wall.c_str());
+    std::string name;
+    double count;
+    while (fields >> name >> count)
+      r.counts[name] = count;
+    if (!logged[id->second].count(n))
+      logged[id->second][n] = r;
+  }
+
+  for (size_t p = 0; p < logged.size(); p++) {
+    std::map<int, run>::const_iterator r;
+    for (r = logged[p].begin(); r != logged[p].end(); r++) {
+      if (r->first != (int) runs[p].size())
+        break;
+      runs[p].push_back(r->second);
+    }
+  }
+}
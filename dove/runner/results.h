@@ -0,0 +1,38 @@
+#ifndef __RESULTS_H_INCLUDED__
+#define __RESULTS_H_INCLUDED__
+
+#include <cstddef>
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+// The lines of results.log, which keeps every run of every placement:
+//   <placement key> <run> <makespan ns> <wall ns or -> [<counter> <count>]...
+// and the round in which a race dropped a placement:
+//   <placement key> dropped <round>
+// A placement key is a hash of its software and one of its hardware
+namespace results {
+
+  // One run of a placement. wall is -1 if it is not known
+  struct run {
+    double makespan;
+    double wall;
+    std::map<std::string, double> counts;
+  };
+
+  // The line that logs run number of the placement with key, and the 
+  // line that logs a race dropping it in round. Both end in a newline
+  std::string format_run(const std::string &key, int number, const run &r);
+  std::string format_drop(const std::string &key, int round);
+
+  // Reads a log into runs and dropped, indexed by the id ids gives each
+  // placement key. runs gets each placement's runs in order, up to the
+  // first missing one, and dropped the round a race dropped it in, or 0.
+  // The first line for a run or a drop is the one kept. Lines for other
+  // keys are skipped, as is a last line that a crash cut short
+  void read(std::istream &in, const std::map<std::string, size_t> &ids,
+      std::vector<std::vector<run> > &runs, std::vector<int> &dropped);
+}
+
+#endif
@@ -1,14 +1,21 @@
 #include <stdio.h>
-//#include <papi.h>
 #include <dirent.h>
 #include <string.h>
 #include <stdlib.h>
 #include <cstdio>
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <thread>
+#include <mutex>
 #include <time.h>
 
 // XML parsing
@@ -19,7 +26,9 @@
 // Command-line argument parsing
 #include "libs/tclap/CmdLine.h"
 
-#define NUM_EVENTS 1
+#include "dove.h"
+#include "measure.h"
+#include "results.h"
 
 using namespace std;
 
@@ -27,22 +36,113 @@ using namespace std;
 static std::string rank_path;
 static bool delete_rankfiles = false;
 static bool store_logs = false;
+static bool store_traces = false;
+static bool campaign = false;
+// Empty to measure one placement at a time, otherwise socket or host: 
+// the hardware each placement measured at once must have to itself
+static std::string pack_domain;
 static std::string dove_workspace;
 static rapidxml::xml_document<char>* deployments;
 static rapidxml::file<char>* deps_data;
 static std::string deployments_path;
+// Rebuild deployments.xml from results.log without running anything
+static bool materialize = false;
+// Start again instead of resuming from results.log
+static bool fresh = false;
+// Empty to measure every placement fully, otherwise halving or ci: how
+// a race drops placements that are clearly slower than the others
+static std::string race;
+
+// One rankfile that is measured, the tasks file giving the tasks each
+// of its ranks runs (empty if rank N runs task N), and the deployments
+// that use it. key names its runs in results.log: a hash of stg.dag and
+// the tasks file, then a hash of the rankfile
+struct placement {
+  std::string rankfile;
+  std::string tasks;
+  std::vector<rapidxml::xml_node<char>*> deployments;
+  std::string key;
+};
+static std::vector<placement> placements;
+
+// Everything measured about one placement, run by run: its makespan,
+// each perf_event counter the program reported (summed over its 
+// ranks), and the wall-clock time of each launch, mpirun included. A 
+// campaign launches once, so its placements have no wall-clock times
+struct measurement {
+  measure::samples times;
+  std::map<std::string, measure::samples> counters;
+  measure::samples walls;
+};
+
+// Every run is appended to results.log in the dove workspace, and 
+// synced to disk, as soon as it finishes, as are the placements a race
+// drops. results.h gives the lines. The log is never rewritten. A restarted runner replays it, so 
+// placements that met the stopping rule are not run again, the rest 
+// carry on from their last run, and a race carries on without the 
+// placements it dropped
+static int results_fd = -1;
+static std::mutex results_mutex;
+
+// Where a placement runs, as the logical ID of the unit of every line 
+// of its rankfile. valid is false if a line names hardware that is not
+// in system.xml, and then the placement cannot be moved
+struct footprint {
+  bool valid;
+  std::vector<std::string> ranks;
+  std::vector<int> units;
+  // Sockets used on each host, and hosts that a unit takes whole
+  std::map<int, std::set<int> > sockets;
+  std::set<int> whole_hosts;
+};
+
+static dove::system_index* system_desc = NULL;
+// Logical ID of each component by "<hostname> <slot>", as it appears in
+// a rankfile. Equal slots keep the first component
+static std::map<std::string, int> unit_by_slot;
+// Sockets of each host, cores of each socket and threads of each core, 
+// in the order they appear in system.xml
+static std::map<int, std::vector<int> > parts;
+// Hardware threads of each core of a socket, e.g. "2,2,2,2,2,2"
+static std::map<int, std::string> socket_shape;
 
 
 static int k;
 static int M;
 static double E;
+static measure::stopping_rule rule = measure::STOP_KBEST;
 
 
 //prototypes of functions 
 static void parse_options(int argc, char *argv[]);
-int get_rank_count();
-int get_rankfile_count();
-void kbest(int turn,int ranks,int k,int M,double E);
+static void read_placements();
+int get_rank_count(const std::string &rankfile);
+void run_rankfile(const placement &p,const std::string &rankfile,
+    const std::string &hostfile,int ranks,measurement &m,int target);
+static void write_log(const placement &p, const measurement &m);
+static void add_metrics(const placement &p, const measurement &m);
+static void run_packed(std::vector<measurement> &measured, int target,
+    const std::vector<bool> &active);
+static void run_all(std::vector<measurement> &measured, int target,
+    const std::vector<bool> &active);
+static void run_race(std::vector<measurement> &measured, 
+    std::vector<int> &dropped);
+static bool complete(const measurement &m);
+static bool wants_runs(const measurement &m, int target);
+static std::string hash_files(const std::vector<std::string> &paths);
+static std::vector<measurement> load_results(bool fresh, 
+    std::vector<int> &dropped);
+static void append_results(const std::string &text, const placement &p);
+static void add_run(const placement &p, measurement &m, double makespan,
+    double wall, const std::map<std::string, double> &counts, bool log);
+static void index_system();
+static footprint read_footprint(const placement &p);
+static bool relocate(const footprint &f, std::set<int> &taken, 
+    std::string &rankfile, std::set<int> &hosts);
+static void run_campaign(int M, std::vector<measurement> &measured);
+void add_metric_to_deployment(rapidxml::xml_node<char>* dep, 
+    const char* metric_name, 
+    const char* metric_value);
 
 
 void sighandler(int sig)
@@ -63,39 +163,61 @@ main(int argc,char* argv[])
   } 
   catch (TCLAP::ArgException &e) {
     cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return EXIT_FAILURE;
   }
-  int ranks=get_rank_count();
-  int fl_count=get_rankfile_count();
-  cout << ranks << fl_count << endl;
+  read_placements();
+  std::vector<int> dropped(placements.size(), 0);
+  std::vector<measurement> measured = load_results(fresh, dropped);
 
-  //loop on the rank files, for each iteration, k-best scheme is applied
-  int i;
-  for(i=0;i<fl_count;i++)
-  {
-    std::cerr << "Running rankfile." << i << std::endl; 
-    kbest(i,ranks,k,M,E);
+  //each rank file is run until the stopping rule is met, unless a race
+  //drops it first. Every deployment that uses the rankfile gets the 
+  //same result. Drops logged by an earlier race only hold when racing
+  //again or rebuilding the metrics
+  size_t i;
+  if (race.empty() && !materialize)
+    dropped.assign(placements.size(), 0);
+  if (campaign && !materialize)
+    run_campaign(M, measured);
+  else if (!race.empty() && !materialize)
+    run_race(measured, dropped);
+  else if (!materialize)
+    run_all(measured, M, std::vector<bool>(placements.size(), true));
+  for(i=0;i<placements.size();i++) {
+    add_metrics(placements[i], measured[i]);
+    if (dropped[i] == 0)
+      continue;
+    std::stringstream round;
+    round << dropped[i];
+    for (size_t d = 0; d < placements[i].deployments.size(); d++)
+      add_metric_to_deployment(placements[i].deployments[d], 
+          "race_dropped", round.str().c_str());
   }
+  if (results_fd >= 0)
+    close(results_fd);
 
   if (delete_rankfiles) {
-    for(i=0;i<fl_count;i++) {
-      std::stringstream s1;
+    for(i=0;i<placements.size();i++) {
       std::string file = dove_workspace;
-      file += "rankfile.";
-      s1 << i;
-      file += s1.str();
+      file += placements[i].rankfile;
       if (0 != remove(file.c_str()))
         std::cerr << "Unable to remove " << file << std::endl;
       else
         std::cout << "Removed " << file << std::endl;
+      if (!placements[i].tasks.empty())
+        remove((dove_workspace + placements[i].tasks).c_str());
     }
   }
 
-  // Write the updated deployment.xml
-  std::ofstream output(deployments_path.c_str(), 
+  // Write the updated deployment.xml, replacing the old one only once 
+  // the new one is complete
+  std::string temporary = deployments_path + ".tmp";
+  std::ofstream output(temporary.c_str(), 
       std::ios::out | std::ios::trunc);
   if (output.is_open()) {
     output << *deployments;
     output.close();
+    if (!output || rename(temporary.c_str(), deployments_path.c_str()) != 0)
+      std::cerr << "Unable to replace deployments.xml" << std::endl;
   } else
     std::cerr << "Unable to open deployments.xml file for writing" 
       << std::endl;
@@ -112,27 +234,111 @@ static void parse_options(int argc, char *argv[])
       "directory. Should contain rankfiles and deployment.xml. Must end with "
       "a slash. ", true, "ranks/", "inputdir path", cmd);
   TCLAP::SwitchArg logs_arg("l","storelogs", "In addition to storing the final metrics "
-      "(currently just total_cpu_cycles) found inside of the deployment.xml, passing "
+      "(time, its summaries and counters) found inside of the deployment.xml, passing "
       "this flag will cause the runner to also create a log file for every rankfile "
       "that shows some output data from the runner and all of the scores that "
-      "existed before kbest was used to compress them to one number", cmd);
+      "existed before the stopping rule was used to summarize them", cmd);
+  TCLAP::SwitchArg trace_arg("","trace", "Have every run write a per-task "
+      "trace, and keep the trace of the fastest run of each rankfile as "
+      "<rankfile>.trace in the dove workspace. placements.txt gives the "
+      "rankfile of each deployment", cmd);
+  TCLAP::SwitchArg campaign_arg("","campaign", "Run every rankfile in one "
+      "mpirun launch, using the campaign.rankfile and campaign.txt written "
+      "by the generator. Each rankfile that is not complete is run for "
+      "the runs it has left of M inside the job, without mpirun startup, "
+      "and the stopping rule is applied to those runs in order. Campaign "
+      "runs record no counters or wall-clock times, and cannot be traced",
+      cmd);
+  std::vector<std::string> domains;
+  domains.push_back("socket");
+  domains.push_back("host");
+  TCLAP::ValuesConstraint<std::string> domain_constraint(domains);
+  TCLAP::ValueArg<std::string> pack_arg("", "pack", "Measure several "
+      "rankfiles at once, each moved onto sockets (or hosts) that no other "
+      "rankfile running at the same time uses. A rankfile is only moved "
+      "onto sockets with the same cores and hardware threads, on hosts "
+      "that keep its sockets together. Reads system.xml from the dove "
+      "workspace", false, "", &domain_constraint);
+  cmd.add(pack_arg);
+  std::vector<std::string> races;
+  races.push_back("halving");
+  races.push_back("ci");
+  TCLAP::ValuesConstraint<std::string> race_constraint(races);
+  TCLAP::ValueArg<std::string> race_arg("", "race", "Race the rankfiles "
+      "against each other, so that clearly slow ones are not run to the "
+      "stopping rule. Every rankfile is first run k times. halving then "
+      "doubles the runs of the faster half by the time recorded and drops"
+      " the rest, round after round. ci adds one run per round and drops "
+      "every rankfile whose median's 95% confidence interval lies wholly "
+      "above that of the fastest. The rankfiles left are then run to the "
+      "stopping rule. Dropped rankfiles keep the metrics of the runs they "
+      "had, plus race_dropped, the round they were dropped in", false, "", 
+      &race_constraint);
+  cmd.add(race_arg);
+  TCLAP::SwitchArg materialize_arg("","materialize", "Do not run anything;"
+      " rebuild the metrics in deployments.xml from the runs in results.log",
+      cmd);
+  TCLAP::SwitchArg fresh_arg("","fresh", "Delete results.log and measure "
+      "every rankfile from its first run, instead of carrying on from the "
+      "runs it holds", cmd);
   TCLAP::SwitchArg remove_ranks_arg("","rmrankfiles", "After finishing all other "
-      "commands successfully, remove all rankfiles from dove workspace", cmd);
+      "commands successfully, remove all rankfiles and tasks files from dove workspace", cmd);
 
+  std::vector<std::string> rules;
+  rules.push_back("kbest");
+  rules.push_back("ci");
+  rules.push_back("bootstrap");
+  TCLAP::ValuesConstraint<std::string> rule_constraint(rules);
+  TCLAP::ValueArg<std::string> rule_arg("r", "rule", "When to stop running "
+      "a rankfile. kbest stops once the k fastest runs are within the "
+      "tolerance of the fastest, and records the fastest as time. ci stops "
+      "once half the width of the 95% confidence interval of the median "
+      "is within the tolerance of the median, and bootstrap once the "
+      "bootstrap standard error of the median is; both record the median "
+      "as time. Defaults to kbest", false, "kbest", &rule_constraint);
+  cmd.add(rule_arg);
   TCLAP::ValueArg<int> k_arg("k", "kvalue", "minimum number of runs",false,3,"integer: k value of k best scheme", cmd); 
   TCLAP::ValueArg<int> m_arg("m", "maximum", "maximum number of runs",false,10,"integer: M value of k best scheme"); 
   cmd.add(m_arg);
   // Tolerance is 1/2 a microsecond. Routing delays are double that
-  TCLAP::ValueArg<double> e_arg("t", "tolerance", "tolerance required to stop runs",false,0.0000005,"double value for tolerance"); 
+  TCLAP::ValueArg<double> e_arg("t", "tolerance", "tolerance required to stop runs, relative to the time recorded",false,0.0000005,"double value for tolerance"); 
   cmd.add(e_arg);
+  TCLAP::ValueArg<std::string> loglevel_arg("", "loglevel", "dove log level: "
+      "error, debug, info, all or a number. Defaults to DOVE_LOG_LEVEL, or "
+      "all", false, "", "level");
+  cmd.add(loglevel_arg);
   cmd.parse(argc, argv);
+  if (loglevel_arg.isSet()) {
+    try {
+      dove::set_log_level(dove::parse_log_level(
+            loglevel_arg.getValue().c_str()));
+    } catch (const char* e) {
+      throw TCLAP::ArgException(e, "loglevel");
+    }
+  }
   rank_path = inp_arg.getValue();
   k=k_arg.getValue();
   M=m_arg.getValue();
   E=e_arg.getValue();
+  rule = measure::parse_rule(rule_arg.getValue().c_str());
 
   delete_rankfiles = remove_ranks_arg.getValue();
   store_logs = logs_arg.getValue();
+  store_traces = trace_arg.getValue();
+  campaign = campaign_arg.getValue();
+  pack_domain = pack_arg.getValue();
+  materialize = materialize_arg.getValue();
+  race = race_arg.getValue();
+  if (campaign && !race.empty())
+    throw TCLAP::ArgException("cannot be combined with --campaign", "race");
+  fresh = fresh_arg.getValue();
+  if (materialize && fresh)
+    throw TCLAP::ArgException("cannot be combined with --fresh", 
+        "materialize");
+  if (campaign && !pack_domain.empty())
+    throw TCLAP::ArgException("cannot be combined with --campaign", "pack");
+  if (campaign && store_traces)
+    throw TCLAP::ArgException("cannot be combined with --campaign", "trace");
   dove_workspace = inp_arg.getValue();
   deployments_path = dove_workspace;
   deployments_path.append("deployments.xml");
@@ -153,17 +359,308 @@ static void parse_options(int argc, char *argv[])
   } 
 }
 
+// Reads placements.txt, written by the generator, to find which 
+// rankfile and tasks file each deployment uses so that each rankfile 
+// is only measured once. Without it every deployment is assumed to have its own 
+// rankfile, named by its id
+static void read_placements()
+{
+  std::map<std::string, rapidxml::xml_node<char>*> by_id;
+  std::vector<rapidxml::xml_node<char>*> in_order;
+  for (rapidxml::xml_node<char> *dep = 
+        deployments->first_node("optimization")->
+        first_node("deployments")->first_node("deployment"); 
+      dep; 
+      dep = dep->next_sibling("deployment"))
+  {
+    rapidxml::xml_attribute<char>* attribute = dep->first_attribute("id");
+    if (attribute == 0) {
+      std::cerr << "Found a deployment with no id!"
+        << std::endl;
+      continue;
+    }
+    by_id[attribute->value()] = dep;
+    in_order.push_back(dep);
+  }
+
+  string filename = rank_path + "placements.txt";
+  ifstream fin(filename.c_str());
+  if (!fin) {
+    for (size_t d = 0; d < in_order.size(); d++) {
+      placement p;
+      p.rankfile = "rankfile.";
+      p.rankfile += in_order[d]->first_attribute("id")->value();
+      p.deployments.push_back(in_order[d]);
+      placements.push_back(p);
+    }
+    return;
+  }
+
+  std::string deployment_id;
+  size_t placement_id;
+  while (fin >> deployment_id >> placement_id) {
+    if (by_id.find(deployment_id) == by_id.end()) {
+      std::cerr << "Did not find a deployment with id "
+        << deployment_id << std::endl;
+      continue;
+    }
+    while (placements.size() <= placement_id) {
+      placement p;
+      std::stringstream name;
+      name << placements.size();
+      p.rankfile = "rankfile." + name.str();
+      p.tasks = "tasks." + name.str();
+      placements.push_back(p);
+    }
+    placements[placement_id].deployments.push_back(by_id[deployment_id]);
+  }
+}
+
+// FNV-1a hash of the contents of files, one after another, in hex. A
+// missing file hashes as an empty one
+static std::string hash_files(const std::vector<std::string> &paths)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+  char buffer[65536];
+  for (size_t f = 0; f < paths.size(); f++) {
+    ifstream fin(paths[f].c_str(), std::ios::binary);
+    while (fin.read(buffer, sizeof(buffer)) || fin.gcount() > 0) {
+      for (std::streamsize b = 0; b < fin.gcount(); b++) {
+        hash ^= (unsigned char) buffer[b];
+        hash *= 1099511628211ULL;
+      }
+    }
+  }
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", hash);
+  return hex;
+}
+
+// Opens results.log for appending, and returns what it already holds 
+// for each placement: its runs in order, up to the first missing one or
+// the one at which the placement was complete. dropped is given the 
+// round in which a race dropped each placement, or 0 if none did
+static std::vector<measurement> load_results(bool fresh, 
+    std::vector<int> &dropped)
+{
+  std::string path = dove_workspace + "results.log";
+  if (fresh)
+    remove(path.c_str());
+
+  // Placements that are written to the same files share their runs
+  std::map<std::string, size_t> by_key;
+  for (size_t p = 0; p < placements.size(); p++) {
+    std::vector<std::string> software(1, dove_workspace + "stg.dag");
+    if (!placements[p].tasks.empty())
+      software.push_back(dove_workspace + placements[p].tasks);
+    std::vector<std::string> hardware(1, 
+        dove_workspace + placements[p].rankfile);
+    placements[p].key = hash_files(software) + " " + hash_files(hardware);
+    by_key.insert(std::make_pair(placements[p].key, p));
+  }
+
+  std::vector<std::vector<results::run> > logged;
+  std::vector<int> logged_drops;
+  ifstream fin(path.c_str());
+  results::read(fin, by_key, logged, logged_drops);
+  fin.close();
+  logged.resize(placements.size());
+  logged_drops.resize(placements.size(), 0);
+
+  std::vector<measurement> measured(placements.size());
+  for (size_t p = 0; p < placements.size(); p++) {
+    size_t shared = by_key[placements[p].key];
+    dropped[p] = logged_drops[shared];
+    for (size_t r = 0; r < logged[shared].size(); r++) {
+      if (complete(measured[p]))
+        break;
+      add_run(placements[p], measured[p], logged[shared][r].makespan, 
+          logged[shared][r].wall, logged[shared][r].counts, false);
+    }
+    if (measured[p].times.size() > 0)
+      cerr << "Resuming " << placements[p].rankfile << " after " << 
+        measured[p].times.size() << " runs" << endl;
+    if (dropped[p] > 0)
+      cerr << placements[p].rankfile << " was dropped in race round " << 
+        dropped[p] << endl;
+  }
+
+  if (!materialize) {
+    results_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (results_fd < 0)
+      cerr << "Unable to open " << path << ", so runs will not be kept" 
+        << endl;
+    else if (lseek(results_fd, 0, SEEK_END) > 0) {
+      // Start on a fresh line if the last run was cut short
+      char last = '\n';
+      int in = open(path.c_str(), O_RDONLY);
+      if (in >= 0) {
+        if (pread(in, &last, 1, lseek(in, 0, SEEK_END) - 1) != 1)
+          last = '\n';
+        close(in);
+      }
+      if (last != '\n' && write(results_fd, "\n", 1) != 1)
+        cerr << "Unable to write to " << path << endl;
+    }
+  }
+  return measured;
+}
+
+// Whether a placement needs no more runs
+static bool complete(const measurement &m)
+{
+  return (int) m.times.size() >= M || m.times.done(rule, k, E);
+}
+
+// Whether a placement needs more runs to reach target runs
+static bool wants_runs(const measurement &m, int target)
+{
+  return !complete(m) && (int) m.times.size() < target;
+}
+
+// Runs every active placement that is not complete until it has target
+// runs, packed onto disjoint hardware if asked to
+static void run_all(std::vector<measurement> &measured, int target,
+    const std::vector<bool> &active)
+{
+  if (!pack_domain.empty()) {
+    run_packed(measured, target, active);
+    return;
+  }
+  for (size_t i = 0; i < placements.size(); i++) {
+    if (!active[i] || !wants_runs(measured[i], target))
+      continue;
+    std::cerr << "Running " << placements[i].rankfile << " for " << 
+      placements[i].deployments.size() << " deployments" << std::endl; 
+    int ranks = get_rank_count(placements[i].rankfile);
+    run_rankfile(placements[i],placements[i].rankfile,"hostfile.txt",
+        ranks,measured[i],target);
+  }
+}
+
+// Races the placements: each round runs those still in the race up to 
+// the round's number of runs, and then drops the ones that are clearly
+// slower. The race ends when one placement is left or none needs more
+// runs, and the placements left are then run to the stopping rule. 
+// dropped holds the round each placement was dropped in, or 0 if it was
+// not. A race resumed from results.log starts with the placements it 
+// had dropped already out, in the round after the last drop
+static void run_race(std::vector<measurement> &measured, 
+    std::vector<int> &dropped)
+{
+  std::vector<bool> active(placements.size(), true);
+  size_t left = placements.size();
+  int first = 1;
+  for (size_t p = 0; p < placements.size(); p++)
+    if (dropped[p] > 0) {
+      active[p] = false;
+      left--;
+      first = std::max(first, dropped[p] + 1);
+    }
+  int target = std::max(k, 1);
+  for (int round = 1; round < first; round++)
+    if (race == "halving")
+      target *= 2;
+    else
+      target++;
+  for (int round = first; left > 1; round++) {
+    run_all(measured, target, active);
+
+    std::vector<size_t> racing;
+    for (size_t p = 0; p < placements.size(); p++)
+      if (active[p])
+        racing.push_back(p);
+
+    std::vector<size_t> drop;
+    if (race == "halving") {
+      // The faster half goes on, with ties kept in placement order
+      std::vector<std::pair<double, size_t> > ranked;
+      for (size_t r = 0; r < racing.size(); r++)
+        ranked.push_back(std::make_pair(
+              measured[racing[r]].times.estimate(rule), racing[r]));
+      std::stable_sort(ranked.begin(), ranked.end());
+      for (size_t r = (ranked.size() + 1) / 2; r < ranked.size(); r++)
+        drop.push_back(ranked[r].second);
+      target *= 2;
+    } else {
+      // Each placement is compared with the one with the fastest median
+      size_t best = racing[0];
+      for (size_t r = 1; r < racing.size(); r++)
+        if (measured[racing[r]].times.median() < 
+            measured[best].times.median())
+          best = racing[r];
+      double best_low, best_high;
+      if (measured[best].times.median_ci(best_low, best_high))
+        for (size_t r = 0; r < racing.size(); r++) {
+          double low, high;
+          if (racing[r] != best && 
+              measured[racing[r]].times.median_ci(low, high) &&
+              low > best_high)
+            drop.push_back(racing[r]);
+        }
+      target++;
+    }
+
+    for (size_t d = 0; d < drop.size(); d++) {
+      active[drop[d]] = false;
+      dropped[drop[d]] = round;
+      left--;
+      append_results(results::format_drop(placements[drop[d]].key, round),
+          placements[drop[d]]);
+    }
+    cerr << "Race round " << round << " dropped " << drop.size() << 
+      " rankfiles, " << left << " left" << endl;
+
+    bool more = false;
+    for (size_t p = 0; p < placements.size(); p++)
+      if (active[p] && !complete(measured[p]))
+        more = true;
+    if (!more)
+      break;
+  }
+
+  run_all(measured, M, active);
+}
+
+// Adds one run to a measurement. Unless the run was read from 
+// results.log, it is appended there and synced before returning, so a
+// run that has returned is never lost. wall is -1 if it is not known
+static void add_run(const placement &p, measurement &m, double makespan,
+    double wall, const std::map<std::string, double> &counts, bool log)
+{
+  if (log && results_fd >= 0) {
+    results::run r;
+    r.makespan = makespan;
+    r.wall = wall;
+    r.counts = counts;
+    append_results(results::format_run(p.key, m.times.size(), r), p);
+  }
+
+  m.times.add(makespan);
+  if (wall >= 0)
+    m.walls.add(wall);
+  std::map<std::string, double>::const_iterator c;
+  for (c = counts.begin(); c != counts.end(); c++)
+    m.counters[c->first].add(c->second);
+}
+
+// Appends a line about a placement to results.log and syncs it
+static void append_results(const std::string &text, const placement &p)
+{
+  if (results_fd < 0)
+    return;
+  std::lock_guard<std::mutex> lock(results_mutex);
+  if (write(results_fd, text.data(), text.size()) != (ssize_t) text.size()
+      || fsync(results_fd) != 0)
+    cerr << "Unable to record " << p.rankfile << " in results.log" << endl;
+}
+
 // Returns number of lines in a rankfile (synonymous to 
 // get_number_cores_used)
-int get_rank_count()
+int get_rank_count(const std::string &rankfile)
 {
   ifstream fin;
-  // TODO - this should really be checked when parsing the 
-  // command line arguments. Can you please make rank_count
-  // and rankfile_count global variables and call these 
-  // functions inside of parse_options, throwing a TCLAP::ArgException
-  // if the necessary files are not available? 
-  string filename = rank_path+"rankfile.0";
+  string filename = rank_path+rankfile;
   fin.open(filename.c_str());
   if (!fin) {
     string error ("File was not readable: ");
@@ -179,58 +676,10 @@ int get_rank_count()
   fin.close();
   return ln_count;
 }
-   
-//returns number of rankfiles, assumes this number to be less than 1000 
-int get_rankfile_count()
-{
-  DIR *d;
-  struct dirent *fs;
-  int fl_count=0;
-  d=opendir(rank_path.c_str());
-  while(fs=readdir(d))
-  {
-    if(strncmp(fs->d_name,"rankfile.",9)==0 && strlen(fs->d_name)<13)
-       fl_count++;
-  } 
-  closedir(d);
-  return fl_count;
-}
 
-void add_metric_to_deployment(int deployment_id, 
+void add_metric_to_deployment(rapidxml::xml_node<char>* dep, 
     const char* metric_name, 
     const char* metric_value) {
-
-  std::stringstream d_id;
-  d_id << deployment_id;
-
-  // First find the deployment node
-  rapidxml::xml_node<char>* dep = NULL;
-  // Cycles every child
-  for (rapidxml::xml_node<char> *nodeChild = 
-        deployments->first_node("optimization")->
-        first_node("deployments")->first_node(); 
-      nodeChild; 
-      nodeChild = nodeChild->next_sibling())
-  {
-    rapidxml::xml_attribute<char>* attribute = 
-      nodeChild->first_attribute("id");
-    if (attribute == 0) {
-      std::cerr << "Found a deployment with no id!"
-        << std::endl;
-      continue;
-    }
-    if (strcmp(attribute->value(), 
-          d_id.str().c_str()) == 0) {
-      dep = nodeChild;
-      break;
-    }
-  }
-  if (dep == NULL) {
-    std::cerr << "Did not find a deployment with id "
-      << deployment_id << std::endl;
-    return;
-  }
-
   // Build a sub-node to add to the deployment
   rapidxml::xml_node<char>* rmetric = deployments->
     allocate_node(rapidxml::node_element, deployments->
@@ -257,109 +706,527 @@ timespec diff(timespec start, timespec end)
   return temp;
 }
 
-void kbest(int turn,int ranks,int k,int M,double E)
+// Launches the placements that are not complete in one campaign, each
+// run for the runs it has left of M, and adds their runs up to the one
+// at which each is complete. Nothing is launched if every placement is
+static void run_campaign(int M, std::vector<measurement> &measured)
+{
+  // campaign.left.txt is campaign.txt with only the placements that are
+  // not complete, each with its own run count
+  ifstream full((dove_workspace + "campaign.txt").c_str());
+  if (!full)
+    throw "Unable to read campaign.txt from the dove workspace";
+  string line;
+  int version = 0, ranks = -1;
+  if (getline(full, line))
+    sscanf(line.c_str(), "dove-campaign %d", &version);
+  if (getline(full, line))
+    sscanf(line.c_str(), "ranks %d", &ranks);
+  if (version != 1 || ranks < 0)
+    throw "campaign.txt is not a campaign from the generator";
+  std::stringstream left;
+  left << "dove-campaign 2\nranks " << ranks << "\n";
+  size_t count = 0;
+  while (getline(full, line)) {
+    stringstream in(line);
+    size_t id;
+    string rest;
+    if (!(in >> id) || !getline(in, rest))
+      continue;
+    if (id >= placements.size() || complete(measured[id]))
+      continue;
+    left << id << " " << M - (int) measured[id].times.size() << rest << 
+      "\n";
+    count++;
+  }
+  full.close();
+  if (count == 0)
+    return;
+  std::string left_path = dove_workspace + "campaign.left.txt";
+  std::ofstream out(left_path.c_str(), std::ios::out | std::ios::trunc);
+  out << left.str();
+  out.close();
+  if (!out)
+    throw "Unable to write campaign.left.txt into the dove workspace";
+  std::string results_path = dove_workspace + "campaign.results";
+  remove(results_path.c_str());
+
+  std::stringstream cmd;
+  cmd << "mpirun --mca opal_set_max_sys_limits 1 --rankfile " << 
+    dove_workspace << "campaign.rankfile --hostfile " << dove_workspace << 
+    "hostfile.txt -np " << get_rank_count("campaign.rankfile") << " " << 
+    dove_workspace << "impl --campaign " << left_path << " --results " << 
+    results_path;
+  cerr << cmd.str() << endl;
+  if (system(cmd.str().c_str()) != 0)
+    cerr << "The campaign did not finish cleanly" << endl;
+
+  // One "<placement id> <run> <ns>" line per run, in the order run
+  std::vector<std::vector<double> > samples(placements.size());
+  ifstream results(results_path.c_str());
+  size_t id;
+  int run;
+  double ns;
+  while (results >> id >> run >> ns)
+    if (id < samples.size())
+      samples[id].push_back(ns);
+
+  // The runs are replayed in order, as if each had been launched alone
+  std::map<std::string, double> no_counts;
+  for (size_t p = 0; p < placements.size(); p++) {
+    if (complete(measured[p]))
+      continue;
+    if (samples[p].empty())
+      cerr << "No results for " << placements[p].rankfile << endl;
+    for (size_t s = 0; s < samples[p].size(); s++) {
+      if (complete(measured[p]))
+        break;
+      add_run(placements[p], measured[p], samples[p][s], -1, no_counts, 
+          true);
+    }
+    if (store_logs)
+      write_log(placements[p], measured[p]);
+  }
+}
+
+// Records the time the stopping rule reports, the summaries of every 
+// run, the median of each counter over the runs, and the fastest 
+// wall-clock time (if known) in every deployment that uses the placement
+static void add_metrics(const placement &p, const measurement &m)
+{
+  // Metrics from an earlier run of the runner are replaced
+  for (size_t d = 0; d < p.deployments.size(); d++) {
+    rapidxml::xml_node<char>* old = p.deployments[d]->first_node("rmetric");
+    while (old != 0) {
+      rapidxml::xml_node<char>* next = old->next_sibling("rmetric");
+      p.deployments[d]->remove_node(old);
+      old = next;
+    }
+  }
+
+  const measure::samples &times = m.times;
+  std::vector<std::pair<std::string, double> > metrics;
+  if (times.size() > 0) {
+    metrics.push_back(std::make_pair("time", times.estimate(rule)));
+    metrics.push_back(std::make_pair("time_min", times.min()));
+    metrics.push_back(std::make_pair("time_median", times.median()));
+    metrics.push_back(std::make_pair("time_mad", times.mad()));
+    double low, high;
+    if (times.median_ci(low, high)) {
+      metrics.push_back(std::make_pair("time_ci_low", low));
+      metrics.push_back(std::make_pair("time_ci_high", high));
+    }
+  }
+  metrics.push_back(std::make_pair("runs", (double) times.size()));
+  std::map<std::string, measure::samples>::const_iterator c;
+  for (c = m.counters.begin(); c != m.counters.end(); c++)
+    metrics.push_back(std::make_pair(c->first, c->second.median()));
+  if (m.walls.size() > 0)
+    metrics.push_back(std::make_pair("wall_time", m.walls.min()));
+
+  for (size_t i = 0; i < metrics.size(); i++) {
+    std::stringstream value;
+    value << std::fixed << std::setprecision(19) << metrics[i].second;
+    for (size_t d = 0; d < p.deployments.size(); d++)
+      add_metric_to_deployment(p.deployments[d], metrics[i].first.c_str(),
+          value.str().c_str());
+  }
+}
+
+// Reads system.xml from the dove workspace and indexes what is needed to
+// move placements between alike sockets and hosts
+static void index_system()
+{
+  std::string path = rank_path + "system.xml";
+  rapidxml::file<char> data(path.c_str());
+  rapidxml::xml_document<char> doc;
+  doc.parse<0>(data.data());
+  system_desc = new dove::system_index(doc);
+
+  dove::hwcom_type types[] = {dove::HOST, dove::SOCKET, dove::CORE, 
+    dove::HW_THREAD};
+  for (int t = 0; t < 4; t++) {
+    const std::vector<int> &ids = system_desc->get_ids(types[t]);
+    for (size_t i = 0; i < ids.size(); i++) {
+      const dove::hwcom &com = system_desc->get(ids[i]);
+      std::string key = com.hostname + " " + com.slot;
+      bool alias = unit_by_slot.find(key) != unit_by_slot.end();
+      if (!alias)
+        unit_by_slot[key] = ids[i];
+      // A socket with the same slot as an earlier one is the same
+      // hardware to OpenMPI, so it is not offered as a separate socket
+      if (types[t] == dove::SOCKET && !alias)
+        parts[com.node_id].push_back(ids[i]);
+      else if (types[t] == dove::CORE)
+        parts[com.proc_id].push_back(ids[i]);
+      else if (types[t] == dove::HW_THREAD)
+        parts[com.core_id].push_back(ids[i]);
+    }
+  }
+
+  const std::vector<int> &sockets = system_desc->get_ids(dove::SOCKET);
+  for (size_t s = 0; s < sockets.size(); s++) {
+    std::stringstream shape;
+    const std::vector<int> &cores = parts[sockets[s]];
+    for (size_t c = 0; c < cores.size(); c++)
+      shape << (c ? "," : "") << parts[cores[c]].size();
+    socket_shape[sockets[s]] = shape.str();
+  }
+}
+
+// Finds the hardware each line of a placement's rankfile uses
+static footprint read_footprint(const placement &p)
+{
+  footprint f;
+  f.valid = true;
+  ifstream fin((rank_path + p.rankfile).c_str());
+  string line;
+  while (getline(fin, line)) {
+    // rank 1=10.0.2.4 slot=p1:8
+    size_t eq = line.find('=');
+    size_t slot = line.find(" slot=");
+    std::map<std::string, int>::const_iterator unit = unit_by_slot.end();
+    if (eq != string::npos && slot != string::npos && slot > eq)
+      unit = unit_by_slot.find(line.substr(eq + 1, slot - eq - 1) + " " +
+          line.substr(slot + 6));
+    if (unit == unit_by_slot.end()) {
+      f.valid = false;
+      return f;
+    }
+
+    const dove::hwcom &com = system_desc->get(unit->second);
+    f.ranks.push_back(line.substr(0, eq + 1));
+    f.units.push_back(unit->second);
+    if (com.type == dove::HOST) {
+      f.whole_hosts.insert(com.node_id);
+      f.sockets[com.node_id].insert(parts[com.node_id].begin(), 
+          parts[com.node_id].end());
+    } else
+      f.sockets[com.node_id].insert(com.proc_id);
+  }
+  f.valid = !f.units.empty();
+  return f;
+}
+
+// Position of a component among the parts of the one holding it
+static size_t part_index(int holder, int id)
+{
+  const std::vector<int> &list = parts[holder];
+  return std::find(list.begin(), list.end(), id) - list.begin();
+}
+
+// Moves a placement onto sockets that are not taken, preferring the 
+// ones it was generated for. Each host the placement uses goes to a 
+// different host, and each socket to a free socket of the same shape 
+// on that host. A host the placement takes whole (or, when packing by
+// host, any host it uses) must be free and must match socket for 
+// socket. system.xml does not describe caches or memory, so a socket 
+// stands in for the L3 and NUMA domain and is never shared. On success
+// marks the sockets taken, and returns the moved rankfile and the hosts
+// it runs on
+static bool relocate(const footprint &f, std::set<int> &taken, 
+    std::string &rankfile, std::set<int> &hosts)
+{
+  bool by_host = pack_domain == "host";
+  const std::vector<int> &all_hosts = system_desc->get_ids(dove::HOST);
+  std::map<int, int> host_map;
+  std::map<int, int> socket_map;
+  std::set<int> chosen;
+
+  std::map<int, std::set<int> >::const_iterator h;
+  for (h = f.sockets.begin(); h != f.sockets.end(); h++) {
+    bool whole = by_host || f.whole_hosts.count(h->first);
+    const std::vector<int> &from = parts[h->first];
+    std::vector<int> candidates(1, h->first);
+    candidates.insert(candidates.end(), all_hosts.begin(), all_hosts.end());
+
+    bool placed = false;
+    for (size_t c = 0; c < candidates.size() && !placed; c++) {
+      int to_host = candidates[c];
+      if (chosen.count(to_host))
+        continue;
+      const std::vector<int> &to = parts[to_host];
+      std::map<int, int> trial;
+      bool fits = true;
+      if (whole) {
+        fits = from.size() == to.size();
+        for (size_t s = 0; fits && s < to.size(); s++)
+          fits = !taken.count(to[s]) && 
+            socket_shape[from[s]] == socket_shape[to[s]];
+        for (size_t s = 0; fits && s < to.size(); s++)
+          trial[from[s]] = to[s];
+      } else {
+        std::set<int> used;
+        std::set<int>::const_iterator s;
+        for (s = h->second.begin(); fits && s != h->second.end(); s++) {
+          // The socket itself, or the first free one of the same shape
+          int pick = -1;
+          if (to_host == h->first && !taken.count(*s))
+            pick = *s;
+          for (size_t t = 0; pick < 0 && t < to.size(); t++)
+            if (!taken.count(to[t]) && !used.count(to[t]) &&
+                socket_shape[to[t]] == socket_shape[*s])
+              pick = to[t];
+          if (pick < 0 || used.count(pick))
+            fits = false;
+          else {
+            used.insert(pick);
+            trial[*s] = pick;
+          }
+        }
+      }
+      if (fits) {
+        placed = true;
+        chosen.insert(to_host);
+        host_map[h->first] = to_host;
+        socket_map.insert(trial.begin(), trial.end());
+      }
+    }
+    if (!placed)
+      return false;
+  }
+
+  std::stringstream text;
+  for (size_t i = 0; i < f.units.size(); i++) {
+    const dove::hwcom &from = system_desc->get(f.units[i]);
+    int to = host_map[from.node_id];
+    if (from.type != dove::HOST) {
+      to = socket_map[from.proc_id];
+      if (from.type != dove::SOCKET)
+        to = parts[to][part_index(from.proc_id, from.core_id)];
+      if (from.type == dove::HW_THREAD)
+        to = parts[to][part_index(from.core_id, from.id)];
+    }
+    const dove::hwcom &com = system_desc->get(to);
+    text << f.ranks[i] << com.hostname << " slot=" << com.slot << "\n";
+  }
+  rankfile = text.str();
+
+  std::map<int, int>::const_iterator m;
+  for (m = host_map.begin(); m != host_map.end(); m++) {
+    hosts.insert(m->second);
+    if (by_host)
+      taken.insert(parts[m->second].begin(), parts[m->second].end());
+  }
+  for (m = socket_map.begin(); m != socket_map.end(); m++)
+    taken.insert(m->second);
+  return true;
+}
+
+// Measures the placements in rounds. Each round packs as many of the 
+// placements left as fit onto disjoint hardware, writes a rankfile and
+// hostfile for each, and runs all of them at once. Placements that 
+// cannot be moved are measured alone. Each active placement is run 
+// until it has target runs or is complete
+static void run_packed(std::vector<measurement> &measured, int target,
+    const std::vector<bool> &active)
+{
+  if (system_desc == NULL)
+    index_system();
+  std::vector<footprint> footprints;
+  for (size_t p = 0; p < placements.size(); p++) {
+    footprints.push_back(read_footprint(placements[p]));
+    if (!footprints[p].valid)
+      cerr << placements[p].rankfile << " uses hardware that is not in "
+        "system.xml, so it will be measured alone" << endl;
+  }
+
+  // hostfile.txt lines by their host, which is its ip or hostname
+  std::map<std::string, std::string> host_lines;
+  ifstream hostfile((rank_path + "hostfile.txt").c_str());
+  string line;
+  while (getline(hostfile, line))
+    host_lines[line.substr(0, line.find(' '))] = line;
+
+  std::vector<bool> done(placements.size(), false);
+  size_t left = placements.size();
+  for (size_t p = 0; p < placements.size(); p++)
+    if (!active[p] || !wants_runs(measured[p], target)) {
+      done[p] = true;
+      left--;
+    }
+  while (left > 0) {
+    std::set<int> taken;
+    std::vector<size_t> round;
+    std::vector<std::string> rankfiles, hostfiles;
+    for (size_t p = 0; p < placements.size(); p++) {
+      if (done[p])
+        continue;
+      if (!footprints[p].valid) {
+        if (!round.empty())
+          continue;
+        round.push_back(p);
+        rankfiles.push_back(placements[p].rankfile);
+        hostfiles.push_back("hostfile.txt");
+        break;
+      }
+
+      std::string text;
+      std::set<int> hosts;
+      if (!relocate(footprints[p], taken, text, hosts))
+        continue;
+      std::string packed = placements[p].rankfile + ".packed";
+      std::string packed_hosts = placements[p].rankfile + ".hosts";
+      ofstream rf((dove_workspace + packed).c_str());
+      rf << text;
+      ofstream hf((dove_workspace + packed_hosts).c_str());
+      for (std::set<int>::const_iterator h = hosts.begin(); 
+          h != hosts.end(); h++) {
+        const dove::hwcom &com = system_desc->get(*h);
+        if (host_lines.count(com.ip))
+          hf << host_lines[com.ip] << endl;
+        else if (host_lines.count(com.hostname))
+          hf << host_lines[com.hostname] << endl;
+        else
+          hf << com.ip << endl;
+      }
+      round.push_back(p);
+      rankfiles.push_back(packed);
+      hostfiles.push_back(packed_hosts);
+    }
+
+    cerr << "Measuring " << round.size() << " of the " << left << 
+      " rankfiles left at once" << endl;
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < round.size(); r++) {
+      const placement &p = placements[round[r]];
+      int ranks = get_rank_count(p.rankfile);
+      measurement *result = &measured[round[r]];
+      const std::string &rankfile = rankfiles[r];
+      const std::string &hostfile = hostfiles[r];
+      threads.push_back(std::thread([&p, ranks, result, &rankfile, 
+            &hostfile, target]() {
+        run_rankfile(p, rankfile, hostfile, ranks, *result, target);
+      }));
+    }
+    for (size_t r = 0; r < round.size(); r++) {
+      threads[r].join();
+      done[round[r]] = true;
+      left--;
+      if (rankfiles[r] != placements[round[r]].rankfile) {
+        remove((dove_workspace + rankfiles[r]).c_str());
+        remove((dove_workspace + hostfiles[r]).c_str());
+      }
+    }
+  }
+}
+
+// Runs a rankfile until the stopping rule is met, it has target runs, 
+// or it has M runs, carrying on from the runs already in m and adding 
+// each new one. The time of a run is the makespan the program prints 
+// on a "dove-makespan <ns>" line, which leaves out mpirun and MPI 
+// startup, and its counters are those on the "dove-counters" line.
+// The placement's rankfile names its log and trace, while rankfile and
+// hostfile are the files launched
+void run_rankfile(const placement &p,const std::string &rankfile,
+    const std::string &hostfile,int ranks,measurement &m,int target)
 {
-  double times[1000]; 
   string cmd;
-  string fname;
 
   //prepare the mpi command to send to system	
-  stringstream s_file,s_rank;
+  stringstream s_rank;
   cmd = "mpirun --mca opal_set_max_sys_limits 1 --rankfile ";
   cmd += dove_workspace;
-  cmd += "rankfile.";
-  s_file << turn;
-  cmd += s_file.str();
+  cmd += rankfile;
   cmd +=" --hostfile ";
   cmd += dove_workspace;
-  cmd += "hostfile.txt";
+  cmd += hostfile;
   cmd += " -np ";
   s_rank << ranks;
   cmd += s_rank.str() + " ";
   cmd += dove_workspace;
   cmd += "impl ";
+  if (!p.tasks.empty())
+    cmd += "--tasks " + dove_workspace + p.tasks + " ";
+  string trace = dove_workspace + p.rankfile + ".trace";
+  string run_trace = trace + ".run";
+  if (store_traces)
+    cmd += "--trace " + run_trace + " ";
   cerr << cmd << endl; 
   
-  fname = dove_workspace + "rankfile." + s_file.str() + ".log";
-  //configure the PAPI counters to be monitored
-  
-  // BIG TODO: If we are measuring hardware-level metrics in a 
-  // distributed system, then we absolutely must measure them on 
-  // multiple machines and then filter all of the metrics down to 
-  // one machine
-  //int Events[NUM_EVENTS]={PAPI_TOT_CYC};
-  //int EventSet=PAPI_NULL;
-  //long_long values[NUM_EVENTS];
-  /* Initialize the Library */
-  //int retval = PAPI_library_init(PAPI_VER_CURRENT);
-  /* Allocate space for the new eventset and do setup */
-  //retval = PAPI_create_eventset(&EventSet);
-  /* Add Flops and total cycles to the eventset */
-  //retval = PAPI_add_events(EventSet,Events,NUM_EVENTS);
-
-  //prepare the file to save the monitored events
-  ofstream tf;
-  stringstream buf;
-  if (store_logs) {
-    tf.open(fname.c_str());
-    tf << "Run\tExec. Cycles\n-------------------------------\n";
-  }
-
-  int i,j;
-  for(i=0;i<M;i++) 
-    times[i]=9999999;	//initialize executions times to big number
+  const measure::samples &times = m.times;
 
-  for(i=0;i<M;i++)   //each iteration is one monitored run
+  for (int i = times.size(); wants_runs(m, target); i++)   //each iteration is one monitored run
   {   
     cerr << "run:" << i+1 << endl;     
-    //retval = PAPI_start(EventSet);
     timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
-    system(cmd.c_str());	//code to be evaluated
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    //retval = PAPI_stop(EventSet,values);
-    times[i]= diff(start, end).tv_sec*1000000000 + diff(start, end).tv_nsec;  //values[0];
-    if (store_logs) 
-      tf << i << "\t" << times[i] << endl; 
-    //place new run time to its location in sorted array
-    int ii=i;
-    for(j=i-1;j>=0;j--,ii--)
-      if(times[ii]<times[j]) //swap
-      {
-          double t=times[ii];
-          times[ii]=times[j];
-          times[j]=t;
-      }
-     
-    //now we r sure execution times array is sorted
-    //we can compare the best time to the kth best time
-    double range_of_top_k_scores = (times[k-1]-times[0]) / times[0];  
-    if(i >= k-1 && range_of_top_k_scores <= E)
-    {
-      if (store_logs) {
-        tf << "Number of runs = " << i+1 << endl;
-        tf << "Fastest execution = " << times[0] << " cycles." << endl;
-        tf << k << "th fastest execution = " << times[k-1] << " cycles." << endl;
-        tf << k << "th fastest = " << 1 + range_of_top_k_scores  << "of the fastest." << endl;
+    // The program's output is passed through, apart from its makespan
+    // and counters
+    double makespan = -1;
+    std::map<std::string, double> counters;
+    FILE* run = popen(cmd.c_str(), "r");	//code to be evaluated
+    if (run != NULL) {
+      char line[4096];
+      while (fgets(line, sizeof(line), run) != NULL) {
+        if (sscanf(line, "dove-makespan %lf", &makespan) == 1)
+          continue;
+        if (strncmp(line, "dove-counters", 13) != 0) {
+          fputs(line, stdout);
+          continue;
+        }
+        // dove-counters cycles 1234 instructions 5678 ...
+        stringstream counts(line + 13);
+        string name;
+        double count;
+        while (counts >> name >> count)
+          counters[name] = count;
       }
-      break;
+      pclose(run);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double wall_ns = diff(start, end).tv_sec*1000000000 + diff(start, end).tv_nsec;
+    if (makespan < 0) {
+      cerr << rankfile << " printed no makespan, so run " << i+1 << 
+        " is timed by the wall clock" << endl;
+      makespan = wall_ns;
+    }
+    if (store_traces) {
+      // Only the trace of the fastest run so far is kept
+      if (times.size() == 0 || makespan < times.min())
+        rename(run_trace.c_str(), trace.c_str());
+      else
+        remove(run_trace.c_str());
     }
+    add_run(p, m, makespan, wall_ns, counters, true);
   } // End of iterations
 
-  if(i==M && store_logs) //in case we did the maximum number of runs
-  {
-    tf << "Could not converge!!" << endl;
-    tf << "Fastest execution = " << times[0] << "cycles." << endl;
-  }
-
-
-  std::stringstream ktime;
-  ktime << std::fixed << std::setprecision(19) << times[0];
-  add_metric_to_deployment(turn, 
-      "time", ktime.str().c_str());
-
   if (store_logs) 
-    tf.close();
+    write_log(p, m);
 }
 
-
+// Writes <rankfile>.log, with the time, wall-clock time and counters 
+// of every run (where known) and the summary recorded in deployments.xml
+static void write_log(const placement &p, const measurement &m)
+{
+  const measure::samples &times = m.times;
+  bool walls = m.walls.size() == times.size();
+  std::map<std::string, measure::samples>::const_iterator c;
+  ofstream tf((dove_workspace + p.rankfile + ".log").c_str());
+  tf << "Run\tMakespan (ns)";
+  if (walls)
+    tf << "\tWall (ns)";
+  for (c = m.counters.begin(); c != m.counters.end(); c++)
+    tf << "\t" << c->first;
+  tf << "\n-------------------------------\n";
+  for (size_t i = 0; i < times.size(); i++) {
+    tf << i << "\t" << times.runs()[i];
+    if (walls)
+      tf << "\t" << m.walls.runs()[i];
+    for (c = m.counters.begin(); c != m.counters.end(); c++)
+      if (i < c->second.size())
+        tf << "\t" << c->second.runs()[i];
+    tf << endl;
+  }
+  tf << "Number of runs = " << times.size() << endl;
+  if (!times.done(rule, k, E))
+    tf << "Could not converge!!" << endl;
+  tf << "Stopping rule = " << measure::get_rule_name(rule) << endl;
+  tf << "Fastest execution = " << times.min() << " ns." << endl;
+  tf << "Median execution = " << times.median() << " ns." << endl;
+  tf << "Median absolute deviation = " << times.mad() << " ns." << endl;
+  double low, high;
+  if (times.median_ci(low, high))
+    tf << "95% confidence interval of the median = [" << low << ", " << 
+      high << "] ns." << endl;
+}
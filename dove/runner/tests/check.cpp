@@ -0,0 +1,233 @@
+// Unit tests of the runner's measurements and of results.log. Run with 
+// make check
+#include <stdio.h>
+#include <math.h>
+#include <sstream>
+
+#include "../measure.h"
+#include "../results.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  if (!(condition)) { \
+    fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+    failures++; \
+  }
+
+static measure::samples make_samples(int count, const double* times) {
+  measure::samples s;
+  for (int i = 0; i < count; i++)
+    s.add(times[i]);
+  return s;
+}
+
+static void test_summaries() {
+  measure::samples none;
+  CHECK(none.min() == 0 && none.median() == 0 && none.mad() == 0);
+
+  const double odd[] = {5, 1, 4, 2, 3};
+  measure::samples s = make_samples(5, odd);
+  CHECK(s.size() == 5);
+  CHECK(s.runs()[0] == 5 && s.runs()[4] == 3);
+  CHECK(s.min() == 1);
+  CHECK(s.median() == 3);
+  // Deviations 2 2 1 1 0
+  CHECK(s.mad() == 1);
+
+  const double even[] = {10, 40, 20, 30};
+  s = make_samples(4, even);
+  CHECK(s.median() == 25);
+  // Deviations 15 15 5 5
+  CHECK(s.mad() == 10);
+
+  // One outlier moves neither the median nor the MAD far
+  const double outlier[] = {100, 101, 102, 103, 10000};
+  s = make_samples(5, outlier);
+  CHECK(s.median() == 102);
+  CHECK(s.mad() == 1);
+}
+
+// The ranks match the published tables of the distribution-free 95% 
+// interval of the median
+static void test_median_ci() {
+  double low, high;
+  const double five[] = {1, 2, 3, 4, 5};
+  CHECK(!make_samples(5, five).median_ci(low, high));
+
+  double times[20];
+  for (int i = 0; i < 20; i++)
+    times[i] = 20 - i;
+  CHECK(make_samples(6, times).median_ci(low, high));
+  CHECK(low == 15 && high == 20);
+  CHECK(make_samples(10, times).median_ci(low, high));
+  CHECK(low == 12 && high == 19);
+  CHECK(make_samples(20, times).median_ci(low, high));
+  CHECK(low == 6 && high == 15);
+}
+
+static void test_bootstrap() {
+  const double one[] = {7};
+  CHECK(make_samples(1, one).bootstrap_error() == HUGE_VAL);
+  const double zeros[] = {0, 0, 0};
+  CHECK(make_samples(3, zeros).bootstrap_error() == HUGE_VAL);
+
+  const double same[] = {50, 50, 50, 50};
+  CHECK(make_samples(4, same).bootstrap_error() == 0);
+
+  // Fixed resampling makes the error repeatable, and more spread gives
+  // more error
+  const double tight[] = {100, 101, 99, 100, 102, 98, 100, 101};
+  const double loose[] = {100, 150, 60, 100, 170, 40, 100, 130};
+  measure::samples t = make_samples(8, tight);
+  measure::samples l = make_samples(8, loose);
+  CHECK(t.bootstrap_error() == t.bootstrap_error());
+  CHECK(t.bootstrap_error() > 0);
+  CHECK(t.bootstrap_error() < l.bootstrap_error());
+  CHECK(t.bootstrap_error() < 0.05);
+}
+
+static void test_rules() {
+  CHECK(measure::parse_rule("ci") == measure::STOP_CI);
+  CHECK(measure::parse_rule(measure::get_rule_name(measure::STOP_BOOTSTRAP))
+      == measure::STOP_BOOTSTRAP);
+  bool threw = false;
+  try {
+    measure::parse_rule("fastest");
+  } catch (const char*) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  // The 2 fastest are 1% apart
+  const double times[] = {200, 100, 101, 300, 150, 120};
+  measure::samples s = make_samples(3, times);
+  CHECK(!s.done(measure::STOP_KBEST, 4, 1));
+  CHECK(s.done(measure::STOP_KBEST, 2, 0.01));
+  CHECK(!s.done(measure::STOP_KBEST, 2, 0.005));
+  CHECK(!s.done(measure::STOP_KBEST, 3, 0.5));
+  CHECK(s.estimate(measure::STOP_KBEST) == 100);
+  CHECK(s.estimate(measure::STOP_CI) == 101);
+
+  // Too few runs for an interval
+  CHECK(!s.done(measure::STOP_CI, 1, 100));
+  s = make_samples(6, times);
+  // From 100 to 300 around a median of 135
+  CHECK(s.done(measure::STOP_CI, 1, 0.75));
+  CHECK(!s.done(measure::STOP_CI, 1, 0.7));
+
+  const double same[] = {50, 50, 50};
+  CHECK(make_samples(3, same).done(measure::STOP_BOOTSTRAP, 3, 0));
+  CHECK(!make_samples(3, same).done(measure::STOP_BOOTSTRAP, 4, 0));
+}
+
+static results::run make_run(double makespan, double wall) {
+  results::run r;
+  r.makespan = makespan;
+  r.wall = wall;
+  return r;
+}
+
+static void test_format() {
+  results::run r = make_run(1234.4, -1);
+  CHECK(results::format_run("aa bb", 3, r) == "aa bb 3 1234 -\n");
+  r.wall = 5678;
+  r.counts["instructions"] = 20;
+  r.counts["cycles"] = 10;
+  CHECK(results::format_run("aa bb", 0, r) == 
+      "aa bb 0 1234 5678 cycles 10 instructions 20\n");
+  CHECK(results::format_drop("aa bb", 2) == "aa bb dropped 2\n");
+}
+
+// Every line the runner writes is read back as it was
+static void test_round_trip() {
+  std::map<std::string, size_t> ids;
+  ids["s h0"] = 0;
+  ids["s h1"] = 1;
+  std::stringstream log;
+  results::run r = make_run(1000, 2000);
+  r.counts["cycles"] = 300;
+  log << results::format_run("s h0", 0, r);
+  log << results::format_run("s h1", 0, make_run(900, -1));
+  log << results::format_drop("s h1", 3);
+  log << results::format_run("s h0", 1, make_run(1100, 2100));
+
+  std::vector<std::vector<results::run> > runs;
+  std::vector<int> dropped;
+  results::read(log, ids, runs, dropped);
+  CHECK(runs.size() == 2 && dropped.size() == 2);
+  CHECK(runs[0].size() == 2 && runs[1].size() == 1);
+  CHECK(runs[0][0].makespan == 1000 && runs[0][0].wall == 2000);
+  CHECK(runs[0][0].counts.size() == 1 && runs[0][0].counts["cycles"] == 300);
+  CHECK(runs[0][1].makespan == 1100 && runs[0][1].counts.empty());
+  CHECK(runs[1][0].wall == -1);
+  CHECK(dropped[0] == 0 && dropped[1] == 3);
+}
+
+static void test_replay() {
+  std::map<std::string, size_t> ids;
+  ids["s h0"] = 0;
+  ids["s h1"] = 1;
+  ids["s h2"] = 2;
+  // Runs out of order, a repeat, a gap, other keys, comments, garbage,
+  // a second drop and a last line that a crash cut short
+  std::stringstream log;
+  log << "# comment\n"
+      << "s h0 1 200 -\n"
+      << "s h0 0 100 -\n"
+      << "s h0 0 999 -\n"
+      << "\n"
+      << "other key 0 5 -\n"
+      << "s h1 0 10 -\n"
+      << "s h1 2 30 -\n"
+      << "s h1 x 40 -\n"
+      << "s h1 1x 40 -\n"
+      << "s h1\n"
+      << "s h2 dropped 1\n"
+      << "s h2 dropped 4\n"
+      << "s h2 dropped -1\n"
+      << "s h0 2 300 -\n"
+      << "s h0 3 400 12";
+
+  std::vector<std::vector<results::run> > runs;
+  std::vector<int> dropped;
+  results::read(log, ids, runs, dropped);
+  CHECK(runs[0].size() == 3);
+  CHECK(runs[0][0].makespan == 100 && runs[0][1].makespan == 200 &&
+      runs[0][2].makespan == 300);
+  // Run 2 of h1 waits for run 1, which was never logged
+  CHECK(runs[1].size() == 1 && runs[1][0].makespan == 10);
+  CHECK(runs[2].empty());
+  CHECK(dropped[0] == 0 && dropped[1] == 0 && dropped[2] == 1);
+
+  // A line that was cut short and then finished by a resumed runner is
+  // read, as the runner starts it on a new line
+  std::stringstream resumed;
+  resumed << "s h0 0 10\n" << "s h0 0 100 -\n";
+  results::read(resumed, ids, runs, dropped);
+  CHECK(runs[0].size() == 1 && runs[0][0].makespan == 100);
+
+  // Placements with the same files share a key, so ids may skip some
+  ids.clear();
+  ids["s h0"] = 3;
+  std::stringstream shared;
+  shared << "s h0 0 7 -\n";
+  results::read(shared, ids, runs, dropped);
+  CHECK(runs.size() == 4 && runs[3].size() == 1 && runs[0].empty());
+}
+
+int main() {
+  test_summaries();
+  test_median_ci();
+  test_bootstrap();
+  test_rules();
+  test_format();
+  test_round_trip();
+  test_replay();
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
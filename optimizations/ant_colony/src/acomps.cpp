@@ -37,9 +37,13 @@ static unsigned int maxmin_frequency = 5;
 static double maxmin_a = 2.0;
 static double acs_q0 = 0.5;
 static double acs_xi = 0.1;
+static unsigned int flush_interval = 100;
+static std::string selection = "first";
+static std::string unit_type = "cores";
 
 // Arguments for deployment optimization
 static std::string stg_filepath;
+static std::string edges_filepath;
 static unsigned int cores_used = 2;
 //static unsigned int processor_heterogenity = 1;
 //static unsigned int routing_heterogenity = 1;
@@ -82,7 +86,7 @@ static void parse_options(int argc, char *argv[]) {
   stg_variants.push_back(&dove_arg);
   stg_variants.push_back(&filepath_arg);
   cmd.xorAdd(stg_variants);
-  TCLAP::ValueArg<unsigned int> cores_used_arg("c", "cores", "number of homogeneous processing cores. Defaults to 2", false, 2, "positive integer", cmd);
+  TCLAP::ValueArg<unsigned int> cores_used_arg("c", "cores", "number of homogeneous processing units, of the type given by --units. Defaults to 2", false, 2, "positive integer", cmd);
 //  TCLAP::ValueArg<unsigned int> processor_h_arg("","core_heter", "Processor heterogeneity. 1 specifies homogeneous processors, <int> specifies a limit on processor upper bound that is randomly queried to build a set of heterogeneous processors. Default is 1", false, 1, "positive integer", cmd);
   TCLAP::SwitchArg              print_tour_arg("o", "printord", "print best elimination ordering in iteration");
 //  TCLAP::ValueArg<unsigned int> task_harg("", "task_heter", "task heterogeneity. 1 specifies to leave task homogenity alone, <int> specifies a limit on the upper bound a task completion time can be multiplied by. Default is 1", false, 1, "positive integer");
@@ -100,6 +104,23 @@ static void parse_options(int argc, char *argv[]) {
   TCLAP::SwitchArg              acs_as_arg("", "acs", "use Ant Colony System");
   TCLAP::ValueArg<double>       acs_q0_arg("", "acs_q0", "q0 parameter for Ant Colony System", false, acs_q0, "double");
   TCLAP::ValueArg<double>       acs_xi_arg("", "acs_xi", "xi parameter for Ant Colony System", false, acs_xi, "double");
+  TCLAP::ValueArg<unsigned int> flush_arg("", "flush", "stream deployments.xml to disk while running, flushing every n deployments. 0 keeps all deployments in memory until the optimization completes", false, flush_interval, "integer");
+  std::vector<std::string> strategies;
+  strategies.push_back("first");
+  strategies.push_back("compact");
+  strategies.push_back("scatter");
+  strategies.push_back("latency");
+  TCLAP::ValuesConstraint<std::string> strategy_names(strategies);
+  TCLAP::ValueArg<std::string>  select_arg("", "select", "strategy dove uses to choose which cores to optimize over", false, selection, &strategy_names);
+  std::vector<std::string> types;
+  types.push_back("cores");
+  types.push_back("hw-threads");
+  types.push_back("processors");
+  types.push_back("nodes");
+  TCLAP::ValuesConstraint<std::string> type_names(types);
+  TCLAP::ValueArg<std::string>  edges_arg("", "edges", "path to the per-edge message sizes of the STG, one '<from> <to> <bytes>' line per edge. Defaults to the STG path with an .edges extension, and is optional", false, "", "filepath");
+  TCLAP::ValueArg<std::string>  loglevel_arg("", "loglevel", "dove log level: error, debug, info, all or a number. Defaults to DOVE_LOG_LEVEL, or all", false, "", "level");
+  TCLAP::ValueArg<std::string>  units_arg("", "units", "type of hardware unit that tasks are deployed onto", false, unit_type, &type_names);
   std::vector<TCLAP::Arg *> as_variants;
   as_variants.push_back(&simple_as_arg);
   as_variants.push_back(&elitist_as_arg);
@@ -120,6 +141,11 @@ static void parse_options(int argc, char *argv[]) {
   cmd.add(maxmin_a_arg);
   cmd.add(acs_q0_arg);
   cmd.add(acs_xi_arg);
+  cmd.add(flush_arg);
+  cmd.add(select_arg);
+  cmd.add(units_arg);
+  cmd.add(loglevel_arg);
+  cmd.add(edges_arg);
   cmd.xorAdd(as_variants);
   //cmd.add(routing_h_arg);
   //cmd.add(routing_def_arg);
@@ -148,6 +174,16 @@ static void parse_options(int argc, char *argv[]) {
   acs_as_flag = acs_as_arg.isSet();
   acs_q0 = acs_q0_arg.getValue();
   acs_xi = acs_xi_arg.getValue();
+  flush_interval = flush_arg.getValue();
+  selection = select_arg.getValue();
+  unit_type = units_arg.getValue();
+  if (loglevel_arg.isSet()) {
+    try {
+      dove::set_log_level(dove::parse_log_level(loglevel_arg.getValue().c_str()));
+    } catch (const char* e) {
+      throw TCLAP::ArgException(e, "loglevel");
+    }
+  }
   cores_used = cores_used_arg.getValue();
   //processor_heterogenity=processor_h_arg.getValue();
   //routing_heterogenity=routing_h_arg.getValue();
@@ -178,13 +214,21 @@ static void parse_options(int argc, char *argv[]) {
   }
 
   tasks = Parser::parse_stg(stg_filepath.c_str(), task_precedence);
+  if (edges_arg.isSet())
+    edges_filepath = edges_arg.getValue();
+  else
+    edges_filepath = dove::get_edges_path(stg_filepath);
 
   validation = new dove::validator(tasks->size(), 
     cores_used,
-    dove::CORE, 
+    dove::parse_type_name(unit_type.c_str()), 
     deps.c_str(),
     "Ant Colony Optimization",
-    sys.c_str());
+    sys.c_str(),
+    "",
+    dove::parse_strategy(selection.c_str()));
+  if (flush_interval != 0)
+    validation->stream_deployments(flush_interval);
   
   if(stag_variance_arg.isSet()) {
     stagnation_measure = STAG_VARIATION_COEFFICIENT;
@@ -301,9 +345,12 @@ bool identifier_sort(Task a, Task b) {
 void run_entire_aco(DirectedAcyclicGraph* task_precedence,
                     SymmetricMatrix<unsigned int>* routing_costs,
                     Matrix<unsigned int>* run_times,
-                    std::vector<unsigned int>* task_scheduling_order) {
+                    std::vector<unsigned int>* task_scheduling_order,
+                    std::vector<std::vector<std::pair<unsigned int, double> > >* edge_bytes,
+                    Matrix<double>* bandwidths) {
   
-  MpsProblem *problem = new MpsProblem(routing_costs, run_times, task_precedence, task_scheduling_order);
+  MpsProblem *problem = new MpsProblem(routing_costs, run_times, task_precedence, task_scheduling_order,
+      edge_bytes, bandwidths);
   colony = get_ant_colony(problem);
   problem->set_ant_colony(colony);
   
@@ -315,6 +362,9 @@ void run_entire_aco(DirectedAcyclicGraph* task_precedence,
   *info << (print_tour_flag ? "\tordering" : "");
   *info << std::endl;
   
+  // Refilled every iteration, so building it does not allocate
+  dove::deployment deployment = validation->get_empty_deployment();
+
   timer();
   timer2();
   for(unsigned int i=0;i<iterations && timer() < time_limit;i++) {
@@ -323,7 +373,7 @@ void run_entire_aco(DirectedAcyclicGraph* task_precedence,
     unsigned int task;
     unsigned int core;
     std::vector<unsigned int>::iterator it;
-    dove::deployment deployment = validation->get_empty_deployment();
+    deployment.clear();
     for (it = tour.begin();
         it != tour.end();
         it++) {
@@ -331,9 +381,7 @@ void run_entire_aco(DirectedAcyclicGraph* task_precedence,
       deployment.add_task_deployment(task, core);
     }
     double score = colony->get_best_tour_length_in_iteration();
-    std::stringstream strs;
-    strs << std::fixed << std::setprecision(19) << (score * 1000000000.0);
-    deployment.add_metric("makespan", strs.str().c_str());
+    deployment.add_metric("makespan", score * 1000000000.0);
     validation->add_deployment(deployment);
 
     *info << (i+1) << "\t";
@@ -423,28 +471,69 @@ int main(int argc, char *argv[]) {
   
   std::sort(tasks->begin(), tasks->end(), identifier_sort);
   
-  SymmetricMatrix<unsigned int>* routing_costs = 
+  SymmetricMatrix<unsigned int>* routing_costs =
     new SymmetricMatrix<unsigned int>(cores_used, 0); //routing_default);
+  const long* delays = validation->get_routing_matrix();
   for (int i =0; i < cores_used; i++)
       for (int j =0; j < cores_used; j++) {
-        (*routing_costs)[i][j] = validation->get_routing_delay(i, j);
+        (*routing_costs)[i][j] = delays[i * cores_used + j];
 
         // Before DOVE, routing costs were created like so
         // TODO make it so this can run both with and without dove
         // (*routing_costs)[i][j] *= routing_default * unifRand(1, routing_heterogenity);
       }
   
+  // Data volumes are optional. Without them, messages only pay the
+  // routing delay
+  std::vector<std::vector<std::pair<unsigned int, double> > >* edge_bytes = NULL;
+  Matrix<double>* bandwidths = NULL;
+  std::vector<std::vector<unsigned int> > successors(tasks->size());
+  for (int t = 0; t < tasks->size(); t++)
+    successors[t] = task_precedence->get_successors(t);
+  std::vector<dove::edge_volume> volumes = 
+    dove::read_edge_volumes(edges_filepath.c_str(), successors);
+  if (volumes.size() != 0) {
+    // Kept per task and sorted by successor, as a dense tasks x tasks 
+    // matrix would be almost entirely zeros for large STGs
+    edge_bytes = new std::vector<std::vector<std::pair<unsigned int, double> > >(
+        tasks->size());
+    for (int e = 0; e < volumes.size(); e++) {
+      (*edge_bytes)[volumes[e].from].push_back(std::make_pair(
+            (unsigned int) volumes[e].to, (double) volumes[e].bytes));
+    }
+    for (int t = 0; t < edge_bytes->size(); t++)
+      std::sort((*edge_bytes)[t].begin(), (*edge_bytes)[t].end());
+
+    bandwidths = new Matrix<double>(cores_used, cores_used, 0);
+    const double* bytes_per_sec = validation->get_bandwidth_matrix();
+    bool any_bandwidth = false;
+    for (int i = 0; i < cores_used; i++)
+      for (int j = 0; j < cores_used; j++) {
+        (*bandwidths)[i][j] = bytes_per_sec[i * cores_used + j];
+        any_bandwidth = any_bandwidth || (*bandwidths)[i][j] > 0;
+      }
+    // Without bandwidths every message would be free, and the edge 
+    // volumes would be silently ignored
+    if (cores_used > 1 && !any_bandwidth) {
+      std::cerr << "error: " << edges_filepath << " gives message sizes, "
+        "but system.xml has no bandwidths (the b attribute of its <d> "
+        "tags). Run profile_latency with --bandwidth <bytes>" << std::endl;
+      throw "Edge volumes need bandwidths in system.xml";
+    }
+  }
+
   // Build the run times by combining information about cores and tasks
   Matrix<unsigned int>* run_times = 
     new Matrix<unsigned int>((int) tasks->size(), cores_used, 0);
+  // Speeds are relative to the fastest unit, which runs a task in its 
+  // STG execution time. Without speeds in system.xml every unit is 1.0
+  const double* speeds = validation->get_execution_speeds();
   for (int task = 0; task < tasks->size(); task++)
     for (int core = 0; core < cores_used; core++)
       // Before DOVE
       // (*run_times)[task][core] = tasks->at(task).execution_time_ * touse[core].speed_multiplier_;
-
-      // With DOVE, there is no multiplier currently because the generator creates an amount 
-      // of time delay, not an amount of work
-      (*run_times)[task][core] = tasks->at(task).execution_time_;  
+      (*run_times)[task][core] = (unsigned int) (tasks->at(task).execution_time_ / 
+          (speeds != NULL && speeds[core] > 0 ? speeds[core] : 1.0) + 0.5);
 
   // Initially reorder tasks by precedence to create at least a simple but somewhat reasonable sorting order
   // then flatten into scheduling order
@@ -452,10 +541,13 @@ int main(int argc, char *argv[]) {
   std::vector<unsigned int> scheduling_order(tasks->size());
   for (int task = 0; task < tasks->size(); task++)
     scheduling_order[task] = tasks->at(task).int_identifier_;
-  run_entire_aco(task_precedence, routing_costs, run_times, &scheduling_order);
+  run_entire_aco(task_precedence, routing_costs, run_times, &scheduling_order,
+      edge_bytes, bandwidths);
 
   delete task_precedence;
   delete routing_costs;
+  delete edge_bytes;
+  delete bandwidths;
   delete run_times;
   delete validation;  
   delete colony;
@@ -16,7 +16,9 @@
 MpsProblem::MpsProblem(SymmetricMatrix<unsigned int>* routing_costs,
                        Matrix<unsigned int>*          run_times,
                        DirectedAcyclicGraph*          task_precedence,
-                       std::vector<unsigned int>*     task_scheduling_order) :
+                       std::vector<unsigned int>*     task_scheduling_order,
+                       std::vector<std::vector<std::pair<unsigned int, double> > >* edge_bytes,
+                       Matrix<double>*                bandwidths) :
                       current_tour_length_(0), tour_evaluation_cache(-1.0),
                       local_search_requested_(false) {
   debug("MpsProblem::MpsProblem");
@@ -29,6 +31,8 @@ MpsProblem::MpsProblem(SymmetricMatrix<unsigned int>* routing_costs,
                         
   running_times_ = run_times;
   routing_costs_ = routing_costs;
+  edge_bytes_ = edge_bytes;
+  bandwidths_ = bandwidths;
   precedence_graph_ = task_precedence;
   task_scheduling_order_ = task_scheduling_order;
 }
@@ -159,6 +163,12 @@ double MpsProblem::eval_tour(const std::vector<unsigned int> &tour){
     // Delay all of our successors, except for the final dummy node
     // Node 0 will never be a successor either
     Row<unsigned int> successors = precedence_graph_->get_successor_row(task);
+    // Both the row and the edges that carry data are in successor order,
+    // so the next edge with data is found by moving forward through them
+    const std::vector<std::pair<unsigned int, double> >* bytes = NULL;
+    if (edge_bytes_ != NULL && !edge_bytes_->empty())
+      bytes = &(*edge_bytes_)[task];
+    unsigned int next_bytes = 0;
     for (int cur=1; cur < successors.size() - 1; cur++)
     {
       // Are they actually a successor?
@@ -171,6 +181,16 @@ double MpsProblem::eval_tour(const std::vector<unsigned int> &tour){
       // Assume all routing times are nanoseconds 
       // TODO update dove
       routing_time = routing_time / 1000000000;
+      
+      // Plus the time to move the message's data, if we know it
+      if (bytes != NULL && core != their_core) {
+        while (next_bytes < bytes->size() && (*bytes)[next_bytes].first < cur)
+          next_bytes++;
+        double bandwidth = (*bandwidths_)[core][their_core];
+        if (bandwidth > 0 && next_bytes < bytes->size() && 
+            (*bytes)[next_bytes].first == cur)
+          routing_time += (*bytes)[next_bytes].second / bandwidth;
+      }
       double earliest_start_time = finish_time + routing_time;
       
       current_task_completion_time[cur] = std::max(current_task_completion_time[cur],
@@ -56,6 +56,18 @@ private:
   // always equal routing_costs_[j][i]
   SymmetricMatrix<unsigned int>* routing_costs_;
   
+  // The size in bytes of the message sent along each precedence edge.
+  // edge_bytes_[i] lists (j, bytes) for every successor j of task i whose
+  // edge carries data, sorted by j, so that it can be walked alongside
+  // task i's successor row. NULL if the software model carries no data, 
+  // in which case only routing costs apply
+  std::vector<std::vector<std::pair<unsigned int, double> > >* edge_bytes_;
+  
+  // Bandwidth in bytes per second for sending between cores.
+  // bandwidths_[i][j] is 0 if the bandwidth from i to j is not known, and
+  // data is then sent for free
+  Matrix<double>* bandwidths_;
+  
   // The time needed to run each task on a core
   // running_times_[i][j] is the time needed to run task i on core j, and
   // running_times_[j][i] is the time needed to run task j on core i
@@ -133,7 +145,9 @@ public:
   MpsProblem(SymmetricMatrix<unsigned int>* routing_costs,
              Matrix<unsigned int>*          run_times,
              DirectedAcyclicGraph*          task_precedence,
-             std::vector<unsigned int>*     task_scheduling_order);
+             std::vector<unsigned int>*     task_scheduling_order,
+             std::vector<std::vector<std::pair<unsigned int, double> > >* edge_bytes = NULL,
+             Matrix<double>*                bandwidths = NULL);
   ~MpsProblem();
   unsigned int get_max_tour_size();
   